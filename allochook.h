@@ -0,0 +1,33 @@
+#ifndef ALLOCHOOK_H
+#define ALLOCHOOK_H
+
+/* The benchmark counts heap allocations on the frame thread to hold the
+ * core's per-frame work to none in steady state. Calls that hand over to
+ * Qt or WebKit, which allocate for their own purposes while delivering
+ * events or painting a page, are marked with ALLOC_EXEMPT() for the rest
+ * of the enclosing scope, so only the core's own allocations count.
+ * Handlers Qt calls back into while exempt, such as event filters, use
+ * ALLOC_COUNTED() to be counted again. Everywhere else both compile to
+ * nothing. */
+#ifdef ALLOC_COUNT
+extern thread_local int alloc_exempt;
+
+struct AllocExempt {
+  AllocExempt() { alloc_exempt++; }
+  ~AllocExempt() { alloc_exempt--; }
+};
+
+struct AllocCounted {
+  AllocCounted() : saved(alloc_exempt) { alloc_exempt = 0; }
+  ~AllocCounted() { alloc_exempt = saved; }
+  int saved;
+};
+
+#define ALLOC_EXEMPT() AllocExempt alloc_exempt_scope
+#define ALLOC_COUNTED() AllocCounted alloc_counted_scope
+#else
+#define ALLOC_EXEMPT() do {} while(0)
+#define ALLOC_COUNTED() do {} while(0)
+#endif
+
+#endif // ALLOCHOOK_H
@@ -0,0 +1,121 @@
+#include "batchrenderer.h"
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFile>
+#include <QTextStream>
+#include <QThread>
+#include <stdio.h>
+#include <string.h>
+
+static void addOptions(QCommandLineParser &parser) {
+  parser.addHelpOption();
+  parser.addOptions(QList<QCommandLineOption>()
+      << QCommandLineOption(QStringList() << "o" << "output", "Directory the PNGs are written to.", "dir", ".")
+      << QCommandLineOption(QStringList() << "i" << "input", "File with one URL or path per line, - for stdin.", "file")
+      << QCommandLineOption(QStringList() << "j" << "jobs", "Number of worker processes.", "n", QString::number(QThread::idealThreadCount()))
+      << QCommandLineOption("width", "Viewport width.", "px", "1920")
+      << QCommandLineOption("height", "Viewport height.", "px", "1080")
+      << QCommandLineOption("full-page", "Render the whole page instead of the viewport.")
+      << QCommandLineOption("settle", "Time to wait after the page has loaded.", "msec", "500")
+      << QCommandLineOption("timeout", "Time after which a page counts as failed.", "msec", "30000")
+      << QCommandLineOption("views", "Pages each worker renders at once, sharing its memory.", "n", "1")
+      << QCommandLineOption("worker", "Internal: run as a worker of the pool."));
+  parser.addPositionalArgument("urls", "URLs or local files to render.", "[urls...]");
+}
+
+static BatchOptions readOptions(const QCommandLineParser &parser) {
+  BatchOptions options;
+
+  options.outputDir = parser.value("output");
+  options.viewport = QSize(parser.value("width").toInt(), parser.value("height").toInt());
+  options.fullPage = parser.isSet("full-page");
+  options.settleMsec = parser.value("settle").toInt();
+  options.timeoutMsec = parser.value("timeout").toInt();
+  options.views = parser.value("views").toInt();
+
+  return options;
+}
+
+static bool readList(const QString &path, QStringList &urls) {
+  QFile file;
+
+  if(path == "-") {
+    if(!file.open(stdin, QIODevice::ReadOnly))
+      return false;
+  }else{
+    file.setFileName(path);
+
+    if(!file.open(QIODevice::ReadOnly))
+      return false;
+  }
+
+  QTextStream stream(&file);
+
+  while(!stream.atEnd()) {
+    QString line = stream.readLine().trimmed();
+
+    if(!line.isEmpty() && !line.startsWith('#'))
+      urls << line;
+  }
+
+  return true;
+}
+
+int main(int argc, char *argv[])
+{
+  bool worker = false;
+
+  for(int i = 1; i < argc; i++) {
+    if(!strcmp(argv[i], "--worker"))
+      worker = true;
+  }
+
+  if(worker) {
+    // workers never show anything
+    if(qgetenv("QT_QPA_PLATFORM").isEmpty())
+      qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QApplication a(argc, argv);
+    QCommandLineParser parser;
+
+    addOptions(parser);
+    parser.process(a);
+
+    BatchWorker w(readOptions(parser));
+
+    return a.exec();
+  }
+
+  QCoreApplication a(argc, argv);
+  QCommandLineParser parser;
+  QStringList urls;
+
+  parser.setApplicationDescription("Renders web pages to PNG files with a pool of worker processes.");
+  addOptions(parser);
+  parser.process(a);
+
+  if(parser.isSet("input") && !readList(parser.value("input"), urls)) {
+    fprintf(stderr, "Could not read %s\n", parser.value("input").toUtf8().constData());
+    return 1;
+  }
+
+  urls << parser.positionalArguments();
+
+  if(urls.isEmpty())
+    parser.showHelp(1);
+
+  BatchOptions options = readOptions(parser);
+
+  // workers resolve the directory themselves, so make it absolute now
+  options.outputDir = QDir(options.outputDir).absolutePath();
+  QDir().mkpath(options.outputDir);
+
+  BatchPool pool(options, parser.value("jobs").toInt());
+
+  QObject::connect(&pool, SIGNAL(finished()), &a, SLOT(quit()));
+  pool.run(urls);
+  a.exec();
+
+  return pool.failed() ? 2 : 0;
+}
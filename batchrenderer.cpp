@@ -0,0 +1,419 @@
+#include "batchrenderer.h"
+#include "minibrowser.h"
+#include <QCoreApplication>
+#include <QSocketNotifier>
+#include <QTimer>
+#include <QImage>
+#include <QPainter>
+#include <QWebPage>
+#include <QWebFrame>
+#include <stdio.h>
+#include <unistd.h>
+
+/* Full-page captures are cut off here; some pages scroll forever. */
+#define BATCH_MAX_PAGE_HEIGHT 16384
+
+/* Workers that may fail to start before the pages left are given up on. */
+#define BATCH_MAX_START_FAILURES 3
+
+BatchOptions::BatchOptions() :
+  outputDir(".")
+  ,viewport(1920, 1080)
+  ,fullPage(false)
+  ,settleMsec(500)
+  ,timeoutMsec(30000)
+  ,views(1)
+{
+}
+
+/* The options a worker needs, in the form main() parses them. */
+QStringList BatchOptions::arguments() const {
+  QStringList args;
+
+  args << "--output" << outputDir
+       << "--width" << QString::number(viewport.width())
+       << "--height" << QString::number(viewport.height())
+       << "--settle" << QString::number(settleMsec)
+       << "--timeout" << QString::number(timeoutMsec)
+       << "--views" << QString::number(views);
+
+  if(fullPage)
+    args << "--full-page";
+
+  return args;
+}
+
+BatchView::BatchView(const BatchOptions &options, BatchView *shareWith, QObject *parent) :
+  QObject(parent)
+  ,m_options(options)
+  ,m_browser(new MiniBrowser)
+  ,m_settle(new QTimer(this))
+  ,m_timeout(new QTimer(this))
+  ,m_current(-1)
+  ,m_latency()
+{
+  QWebPage *page = m_browser->page();
+
+  if(shareWith)
+    m_browser->shareNetwork(shareWith->m_browser);
+
+  // the window is never shown, so nothing resizes the page after this
+  page->setViewportSize(m_options.viewport);
+  page->mainFrame()->setScrollBarPolicy(Qt::Horizontal, Qt::ScrollBarAlwaysOff);
+  page->mainFrame()->setScrollBarPolicy(Qt::Vertical, Qt::ScrollBarAlwaysOff);
+
+  m_settle->setSingleShot(true);
+  m_timeout->setSingleShot(true);
+
+  connect(page, SIGNAL(loadFinished(bool)), this, SLOT(onLoadFinished(bool)));
+  connect(m_settle, SIGNAL(timeout()), this, SLOT(onSettled()));
+  connect(m_timeout, SIGNAL(timeout()), this, SLOT(onTimeout()));
+}
+
+BatchView::~BatchView()
+{
+  delete m_browser;
+}
+
+bool BatchView::isIdle() const {
+  return m_current < 0;
+}
+
+void BatchView::start(int index, const QUrl &url) {
+  m_current = index;
+  m_latency.start();
+  m_timeout->start(m_options.timeoutMsec);
+  m_browser->page()->mainFrame()->load(url);
+}
+
+void BatchView::onLoadFinished(bool ok) {
+  if(m_current < 0)
+    return;
+
+  if(!ok) {
+    finish(false, "load failed");
+    return;
+  }
+
+  // scripts that navigate again after load restart the wait
+  m_settle->start(m_options.settleMsec);
+}
+
+void BatchView::onSettled() {
+  QWebPage *page = m_browser->page();
+  QWebFrame *frame = page->mainFrame();
+  QSize size = m_options.viewport;
+
+  if(m_options.fullPage) {
+    size = frame->contentsSize().expandedTo(m_options.viewport);
+    size.setHeight(qMin(size.height(), BATCH_MAX_PAGE_HEIGHT));
+    page->setViewportSize(size);
+  }
+
+  QImage image(size, QImage::Format_RGB32);
+  QPainter painter;
+
+  image.fill(Qt::white);
+  painter.begin(&image);
+  frame->render(&painter);
+  painter.end();
+
+  page->setViewportSize(m_options.viewport);
+
+  QString path = QString("%1/%2.png").arg(m_options.outputDir).arg(m_current, 6, 10, QChar('0'));
+
+  if(image.save(path, "PNG"))
+    finish(true, path);
+  else
+    finish(false, "could not write " + path);
+}
+
+void BatchView::onTimeout() {
+  finish(false, "timed out");
+}
+
+void BatchView::finish(bool ok, const QString &message) {
+  int index = m_current;
+
+  m_current = -1;
+  m_settle->stop();
+  m_timeout->stop();
+  m_browser->page()->triggerAction(QWebPage::Stop);
+
+  emit done(index, ok, m_latency.elapsed(), message);
+}
+
+BatchWorker::BatchWorker(const BatchOptions &options, QObject *parent) :
+  QObject(parent)
+  ,m_options(options)
+  ,m_views()
+  ,m_notifier(new QSocketNotifier(STDIN_FILENO, QSocketNotifier::Read, this))
+  ,m_input()
+  ,m_jobs()
+{
+  for(int i = 0; i < qMax(1, m_options.views); i++) {
+    BatchView *view = new BatchView(m_options, m_views.isEmpty() ? 0 : m_views.first(), this);
+
+    connect(view, SIGNAL(done(int, bool, qint64, QString)), this, SLOT(onDone(int, bool, qint64, QString)));
+    m_views.append(view);
+  }
+
+  connect(m_notifier, SIGNAL(activated(int)), this, SLOT(onInput()));
+}
+
+void BatchWorker::onInput() {
+  char buffer[4096];
+  ssize_t size = ::read(STDIN_FILENO, buffer, sizeof(buffer));
+  int end;
+
+  // the pool closed our stdin, nothing more is coming
+  if(size <= 0) {
+    m_notifier->setEnabled(false);
+    next();
+    return;
+  }
+
+  m_input.append(buffer, size);
+
+  while((end = m_input.indexOf('\n')) >= 0) {
+    QList<QByteArray> fields = m_input.left(end).split('\t');
+    Job job;
+
+    m_input.remove(0, end + 1);
+
+    if(fields.size() < 2)
+      continue;
+
+    job.index = fields[0].toInt();
+    job.url = QUrl::fromUserInput(QString::fromUtf8(fields[1]));
+    m_jobs.append(job);
+  }
+
+  next();
+}
+
+void BatchWorker::next() {
+  bool busy = false;
+
+  foreach(BatchView *view, m_views) {
+    if(view->isIdle() && !m_jobs.isEmpty()) {
+      Job job = m_jobs.takeFirst();
+
+      view->start(job.index, job.url);
+    }
+
+    busy = busy || !view->isIdle();
+  }
+
+  if(!busy && m_jobs.isEmpty() && !m_notifier->isEnabled())
+    QCoreApplication::quit();
+}
+
+void BatchWorker::onDone(int index, bool ok, qint64 msec, const QString &message) {
+  fprintf(stdout, "%d\t%s\t%lld\t%s\n", index, ok ? "ok" : "error", (long long)msec, message.toUtf8().constData());
+  fflush(stdout);
+
+  next();
+}
+
+BatchPool::BatchPool(const BatchOptions &options, int workers, QObject *parent) :
+  QObject(parent)
+  ,m_options(options)
+  ,m_workerCount(qMax(1, workers))
+  ,m_workers()
+  ,m_urls()
+  ,m_next(0)
+  ,m_done(0)
+  ,m_failed(0)
+  ,m_startFailures(0)
+  ,m_latencies()
+  ,m_elapsed()
+{
+}
+
+BatchPool::~BatchPool()
+{
+  foreach(Worker *worker, m_workers) {
+    worker->process->disconnect(this);
+    worker->process->kill();
+    worker->process->waitForFinished();
+    delete worker;
+  }
+}
+
+void BatchPool::run(const QStringList &urls) {
+  m_urls = urls;
+  m_next = 0;
+  m_done = 0;
+  m_failed = 0;
+  m_startFailures = 0;
+  m_latencies.clear();
+  m_elapsed.start();
+
+  if(m_urls.isEmpty()) {
+    emit finished();
+    return;
+  }
+
+  // every worker loads WebKit while the first pages are still being fetched
+  for(int i = m_workers.size(); i < qMin(m_workerCount, m_urls.size()); i++)
+    spawn();
+
+  foreach(Worker *worker, m_workers)
+    dispatch(worker);
+}
+
+int BatchPool::failed() const {
+  return m_failed;
+}
+
+void BatchPool::spawn() {
+  Worker *worker = new Worker;
+
+  worker->process = new QProcess(this);
+  worker->process->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+
+  connect(worker->process, SIGNAL(readyReadStandardOutput()), this, SLOT(onReadyRead()));
+  connect(worker->process, SIGNAL(finished(int, QProcess::ExitStatus)), this, SLOT(onWorkerFinished(int, QProcess::ExitStatus)));
+  connect(worker->process, SIGNAL(error(QProcess::ProcessError)), this, SLOT(onWorkerError(QProcess::ProcessError)));
+
+  m_workers.append(worker);
+  worker->process->start(QCoreApplication::applicationFilePath(), QStringList() << "--worker" << m_options.arguments());
+}
+
+/* Keeps one job in flight for each of the worker's views. */
+void BatchPool::dispatch(Worker *worker) {
+  while(worker->jobs.size() < qMax(1, m_options.views) && m_next < m_urls.size()) {
+    int job = m_next++;
+
+    worker->jobs.append(job);
+    worker->process->write(QString("%1\t%2\n").arg(job).arg(m_urls[job]).toUtf8());
+  }
+
+  if(m_next >= m_urls.size())
+    worker->process->closeWriteChannel();
+}
+
+void BatchPool::onReadyRead() {
+  Worker *worker = workerFor(sender());
+  int end;
+
+  if(!worker)
+    return;
+
+  worker->buffer.append(worker->process->readAllStandardOutput());
+
+  while((end = worker->buffer.indexOf('\n')) >= 0) {
+    QList<QByteArray> fields = worker->buffer.left(end).split('\t');
+
+    worker->buffer.remove(0, end + 1);
+
+    if(fields.size() < 4 || !worker->jobs.removeOne(fields[0].toInt()))
+      continue;
+
+    complete(fields[0].toInt(), fields[1] == "ok", fields[2].toLongLong(), QString::fromUtf8(fields[3]));
+    dispatch(worker);
+  }
+}
+
+void BatchPool::onWorkerFinished(int, QProcess::ExitStatus) {
+  Worker *worker = workerFor(sender());
+
+  if(!worker)
+    return;
+
+  m_workers.removeOne(worker);
+  worker->process->deleteLater();
+
+  if(!worker->jobs.isEmpty()) {
+    foreach(int job, worker->jobs)
+      complete(job, false, -1, "worker exited");
+
+    if(m_next < m_urls.size()) {
+      spawn();
+      dispatch(m_workers.last());
+    }
+  }
+
+  delete worker;
+}
+
+/* A worker that never started never finishes either, so its jobs fail
+ * here. Another one takes its place until too many have failed; after
+ * that the workers still running finish the list, or if there are none,
+ * the pages left fail too. */
+void BatchPool::onWorkerError(QProcess::ProcessError error) {
+  Worker *worker = workerFor(sender());
+
+  if(error != QProcess::FailedToStart || !worker)
+    return;
+
+  m_workers.removeOne(worker);
+  worker->process->deleteLater();
+  m_startFailures++;
+
+  foreach(int job, worker->jobs)
+    complete(job, false, -1, "worker failed to start");
+
+  delete worker;
+
+  if(m_next >= m_urls.size())
+    return;
+
+  if(m_startFailures < BATCH_MAX_START_FAILURES) {
+    spawn();
+    dispatch(m_workers.last());
+    return;
+  }
+
+  if(!m_workers.isEmpty())
+    return;
+
+  while(m_next < m_urls.size()) {
+    int job = m_next++;
+
+    complete(job, false, -1, "no worker could be started");
+  }
+}
+
+void BatchPool::complete(int index, bool ok, qint64 msec, const QString &message) {
+  m_done++;
+
+  if(ok)
+    m_latencies.append(msec);
+  else
+    m_failed++;
+
+  fprintf(stdout, "%d\t%s\t%lld\t%s\t%s\n", index, ok ? "ok" : "error", (long long)msec,
+      m_urls[index].toUtf8().constData(), message.toUtf8().constData());
+  fflush(stdout);
+
+  if(m_done == m_urls.size()) {
+    report();
+    emit finished();
+  }
+}
+
+BatchPool::Worker* BatchPool::workerFor(QObject *process) const {
+  foreach(Worker *worker, m_workers) {
+    if(worker->process == process)
+      return worker;
+  }
+
+  return 0;
+}
+
+void BatchPool::report() {
+  double seconds = m_elapsed.elapsed() / 1000.0;
+  QVector<qint64> sorted = m_latencies;
+
+  qSort(sorted);
+
+  fprintf(stderr, "%d pages (%d failed) in %.1f s, %.2f pages/s\n", m_done, m_failed, seconds,
+      seconds > 0 ? m_done / seconds : 0.0);
+
+  if(!sorted.isEmpty())
+    fprintf(stderr, "latency ms: min %lld, median %lld, p95 %lld, max %lld\n",
+        (long long)sorted.first(), (long long)sorted[sorted.size() / 2],
+        (long long)sorted[qMin(sorted.size() - 1, sorted.size() * 95 / 100)], (long long)sorted.last());
+}
@@ -0,0 +1,142 @@
+#ifndef BATCHRENDERER_H
+#define BATCHRENDERER_H
+
+#include <QObject>
+#include <QProcess>
+#include <QElapsedTimer>
+#include <QByteArray>
+#include <QList>
+#include <QSize>
+#include <QStringList>
+#include <QUrl>
+#include <QVector>
+
+class QSocketNotifier;
+class QTimer;
+class MiniBrowser;
+
+struct BatchOptions {
+  BatchOptions();
+
+  QStringList arguments() const;
+
+  QString outputDir;
+  QSize viewport;
+  bool fullPage;
+  int settleMsec;
+  int timeoutMsec;
+  int views;
+};
+
+/* One browser view of a worker and the job it is rendering. Views after
+ * the first share its network, the same way the core's views do. */
+class BatchView : public QObject
+{
+  Q_OBJECT
+
+public:
+  BatchView(const BatchOptions &options, BatchView *shareWith = 0, QObject *parent = 0);
+  ~BatchView();
+
+  bool isIdle() const;
+  void start(int index, const QUrl &url);
+
+signals:
+  void done(int index, bool ok, qint64 msec, const QString &message);
+
+private slots:
+  void onLoadFinished(bool ok);
+  void onSettled();
+  void onTimeout();
+
+private:
+  void finish(bool ok, const QString &message);
+
+  BatchOptions m_options;
+  MiniBrowser *m_browser;
+  QTimer *m_settle;
+  QTimer *m_timeout;
+  int m_current;
+  QElapsedTimer m_latency;
+};
+
+/* Runs in each worker process. Jobs arrive on stdin as "index<TAB>url"
+ * lines and go to whichever of the worker's views is free; the views share
+ * the process's QApplication, fonts, WebKit caches and network. Each is
+ * rendered to <output>/<index>.png and answered on stdout with
+ * "index<TAB>ok|error<TAB>msec<TAB>path or message". */
+class BatchWorker : public QObject
+{
+  Q_OBJECT
+
+public:
+  explicit BatchWorker(const BatchOptions &options, QObject *parent = 0);
+
+private slots:
+  void onInput();
+  void onDone(int index, bool ok, qint64 msec, const QString &message);
+
+private:
+  struct Job {
+    int index;
+    QUrl url;
+  };
+
+  void next();
+
+  BatchOptions m_options;
+  QList<BatchView*> m_views;
+  QSocketNotifier *m_notifier;
+  QByteArray m_input;
+  QList<Job> m_jobs;
+};
+
+/* Starts a fixed number of worker processes up front and hands each one the
+ * next URL from the queue as soon as one of its views is free, so slow pages
+ * don't hold up the rest. A worker that dies fails its jobs and is
+ * replaced. */
+class BatchPool : public QObject
+{
+  Q_OBJECT
+
+public:
+  BatchPool(const BatchOptions &options, int workers, QObject *parent = 0);
+  ~BatchPool();
+
+  void run(const QStringList &urls);
+  int failed() const;
+
+signals:
+  void finished();
+
+private slots:
+  void onReadyRead();
+  void onWorkerFinished(int exitCode, QProcess::ExitStatus status);
+  void onWorkerError(QProcess::ProcessError error);
+
+private:
+  struct Worker {
+    QProcess *process;
+    QList<int> jobs;
+    QByteArray buffer;
+  };
+
+  void spawn();
+  void dispatch(Worker *worker);
+  void complete(int index, bool ok, qint64 msec, const QString &message);
+  Worker* workerFor(QObject *process) const;
+  void report();
+
+  BatchOptions m_options;
+  int m_workerCount;
+  QList<Worker*> m_workers;
+  QStringList m_urls;
+  int m_next;
+  int m_done;
+  int m_failed;
+  int m_startFailures;
+  QVector<qint64> m_latencies;
+  QElapsedTimer m_elapsed;
+};
+
+#endif // BATCHRENDERER_H
@@ -0,0 +1,492 @@
+/* The input helpers under test are static to the core, so the core is
+ * compiled into the benchmark instead of being linked against. */
+#include "libretro.cpp"
+#include "allochook.h"
+
+#include <QCommandLineParser>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QMap>
+#include <QVector>
+#include <math.h>
+
+/* A page that has not finished loading by then is measured as it is. */
+#define BENCH_LOAD_TIMEOUT_MSEC 15000
+
+/* Counts the heap allocations made on the benchmark's thread while a
+ * sample runs, leaving out those under ALLOC_EXEMPT(). glibc exports its
+ * allocator under a second name, so the counting versions can hand over
+ * to it; operator new goes through malloc. */
+thread_local int alloc_exempt;
+static thread_local bool alloc_counting;
+static qint64 alloc_count;
+
+#ifdef __GLIBC__
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t n, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+
+static inline void count_alloc() {
+  if(alloc_counting && !alloc_exempt)
+    alloc_count++;
+}
+
+extern "C" void *malloc(size_t size) {
+  count_alloc();
+  return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t n, size_t size) {
+  count_alloc();
+  return __libc_calloc(n, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) {
+  count_alloc();
+  return __libc_realloc(ptr, size);
+}
+#endif
+
+typedef void (*bench_fn)(void *data);
+
+struct BenchResult {
+  QString name;
+  int samples;
+  qint64 iterations;
+  double mean;
+  double ci;
+  double median;
+  double min;
+  double allocs;
+};
+
+struct Benchmark {
+  const char *name;
+  bench_fn run;
+  bench_fn between; /* untimed, after every sample */
+  void *data;
+  bool zeroAlloc; /* fails the run if it allocates once warmed up */
+};
+
+static volatile quint32 bench_sink;
+static quint32 bench_counter;
+
+/* Two-sided 95% quantiles of Student's t for 1 to 30 degrees of freedom. */
+static const double t_table[] = {
+  12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+  2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+  2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+
+static double t_quantile(int df) {
+  if(df < 1)
+    return 0.0;
+
+  return df <= (int)ARRAY_SIZE(t_table) ? t_table[df - 1] : 1.96;
+}
+
+/* Doubles the iteration count until one sample takes at least sampleMsec,
+ * then takes the samples. All figures are nanoseconds per iteration, except
+ * the allocations, which are counted during the samples only so that the
+ * warm-up absorbs first-use allocations. */
+static BenchResult measure(const Benchmark &bench, int samples, int sampleMsec) {
+  QElapsedTimer timer;
+  QVector<double> times;
+  qint64 iterations = 1;
+  BenchResult result;
+  double sum = 0.0;
+  double variance = 0.0;
+  qint64 allocs = 0;
+
+  for(;;) {
+    timer.start();
+
+    for(qint64 i = 0; i < iterations; i++)
+      bench.run(bench.data);
+
+    if(bench.between)
+      bench.between(bench.data);
+
+    if(timer.elapsed() >= sampleMsec || iterations >= ((qint64)1 << 40))
+      break;
+
+    iterations *= 2;
+  }
+
+  for(int s = 0; s < samples; s++) {
+    alloc_count = 0;
+    alloc_counting = true;
+    timer.start();
+
+    for(qint64 i = 0; i < iterations; i++)
+      bench.run(bench.data);
+
+    times.append((double)timer.nsecsElapsed() / iterations);
+    alloc_counting = false;
+    allocs += alloc_count;
+
+    if(bench.between)
+      bench.between(bench.data);
+  }
+
+  foreach(double t, times)
+    sum += t;
+
+  result.name = bench.name;
+  result.samples = samples;
+  result.iterations = iterations;
+  result.mean = sum / samples;
+  result.allocs = (double)allocs / (iterations * samples);
+
+  foreach(double t, times)
+    variance += (t - result.mean) * (t - result.mean);
+
+  variance = samples > 1 ? variance / (samples - 1) : 0.0;
+  result.ci = t_quantile(samples - 1) * sqrt(variance / samples);
+
+  qSort(times);
+  result.median = times[samples / 2];
+  result.min = times.first();
+
+  return result;
+}
+
+static void process_events(void *) {
+  QCoreApplication::processEvents();
+}
+
+static void bench_render(void *data) {
+  ((MiniBrowser*)data)->render();
+}
+
+/* Moving the cursor damages where it was and where it goes. */
+static void bench_cursor(void *data) {
+  MiniBrowser *browser = (MiniBrowser*)data;
+  QPoint from(100 + bench_counter % 2 * 40, 100);
+
+  bench_counter++;
+  browser->onMouseInput(QtMouse(from, from + QPoint(bench_counter % 2 ? 40 : -40, 0), false, false));
+  browser->drawCursor();
+}
+
+static void bench_get_image(void *data) {
+  bench_sink += *((MiniBrowser*)data)->getImage();
+}
+
+static uint8_t *handoff_buf;
+
+/* What a frontend does with the frame: one full copy out of the image. */
+static void bench_handoff(void *data) {
+  memcpy(handoff_buf, ((MiniBrowser*)data)->getImage(), WIDTH * HEIGHT * 4);
+  bench_sink += handoff_buf[bench_counter++ % (WIDTH * HEIGHT * 4)];
+}
+
+static void bench_mouse_input(void *data) {
+  MiniBrowser *browser = (MiniBrowser*)data;
+  QPoint from((bench_counter * 7) % WIDTH, (bench_counter * 3) % HEIGHT);
+
+  bench_counter++;
+  browser->onMouseInput(QtMouse(from, from + QPoint(5, 3), false, false));
+}
+
+static void bench_key_input(void *data) {
+  ((MiniBrowser*)data)->onRetroKeyInput(QtKey(Qt::Key_A, 'a'), true);
+}
+
+static void bench_retrokey(void *) {
+  unsigned key;
+
+  for(key = RETROK_FIRST; key < RETROK_LAST; key++)
+    bench_sink += retrokey_to_qt(key, key, RETROKMOD_SHIFT).key;
+}
+
+static void stub_input_poll(void) {
+}
+
+/* Holds every input for a few frames in turn, so some change each poll. */
+static int16_t stub_input_state(unsigned port, unsigned device, unsigned index, unsigned id) {
+  (void)port;
+
+  if(device == RETRO_DEVICE_ANALOG)
+    return (int16_t)((bench_counter + index * 2 + id) & 0x7fff);
+
+  return ((bench_counter >> 2) + id) % 16 == 0;
+}
+
+static void bench_update_input(void *data) {
+  bench_counter++;
+  NETRETROPAD_CORE_PREFIX(input_state_cb) = stub_input_state;
+  retropad_update_input((struct browser_view*)data);
+}
+
+static void stub_video_refresh(const void *data, unsigned width, unsigned height, size_t pitch) {
+  (void)width;
+  (void)height;
+  (void)pitch;
+
+  if(data)
+    bench_sink += *(const uint8_t*)data;
+}
+
+/* A frontend with no variables to change and no rate to switch to. */
+static bool stub_environment(unsigned cmd, void *data) {
+  (void)cmd;
+  (void)data;
+
+  return false;
+}
+
+/* Wiggles the mouse and leaves every other input alone. */
+static int16_t stub_run_input_state(unsigned port, unsigned device, unsigned index, unsigned id) {
+  (void)port;
+  (void)index;
+
+  if(device == RETRO_DEVICE_MOUSE && id == RETRO_DEVICE_ID_MOUSE_X)
+    return bench_counter % 2 ? 2 : -2;
+
+  return 0;
+}
+
+/* A whole frame as the frontend asks for it, event processing included,
+ * so the core's handlers for Qt's paint and update events are counted. */
+static void bench_retro_run(void *) {
+  bench_counter++;
+  NETRETROPAD_CORE_PREFIX(input_state_cb) = stub_run_input_state;
+  NETRETROPAD_CORE_PREFIX(retro_run)();
+}
+
+static QString write_page(const QTemporaryDir &dir, const QString &name, const QString &body) {
+  QString path = dir.path() + "/" + name + ".html";
+  QFile file(path);
+
+  if(file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    file.write(QString("<!DOCTYPE html><html><head><meta charset=\"utf-8\"></head><body>%1</body></html>").arg(body).toUtf8());
+
+  return path;
+}
+
+/* Fixed content with no network access, so runs compare across machines
+ * as well as commits. */
+static QMap<QString, QString> write_pages(const QTemporaryDir &dir) {
+  QMap<QString, QString> pages;
+  QString text;
+  QString boxes;
+
+  for(int i = 0; i < 200; i++)
+    text += QString("<h2>Section %1</h2><p>Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do "
+        "eiusmod tempor incididunt ut labore et dolore magna aliqua. <a href=\"#%1\">Link %1</a></p>").arg(i);
+
+  for(int i = 0; i < 400; i++)
+    boxes += QString("<div style=\"position:absolute;left:%1px;top:%2px;width:120px;height:80px;"
+        "border:2px solid #345;border-radius:8px;background:linear-gradient(#%3,#fff);opacity:0.8\"></div>")
+        .arg((i * 97) % 1800).arg((i * 53) % 1000).arg(QString::number(0x102030 + i * 4321, 16).right(6));
+
+  pages["blank"] = write_page(dir, "blank", "");
+  pages["text"] = write_page(dir, "text", text);
+  pages["boxes"] = write_page(dir, "boxes", boxes);
+
+  return pages;
+}
+
+/* Moves a box and scrolls the page on a timer, so every frame has page
+ * damage from both repaints and scrolling. */
+static QString write_animated_page(const QTemporaryDir &dir) {
+  QString text;
+
+  for(int i = 0; i < 200; i++)
+    text += QString("<p>Line %1 of a page long enough to keep scrolling through.</p>").arg(i);
+
+  return write_page(dir, "animated", text
+      + "<div id=\"box\" style=\"position:fixed;top:100px;width:80px;height:80px;background:#c33\"></div>"
+      "<script>var t = 0; setInterval(function() { t++;"
+      " document.getElementById('box').style.left = (t * 7 % 500) + 'px';"
+      " window.scrollTo(0, t * 5 % 3000); }, 16);</script>");
+}
+
+/* Sets up the core as retro_init and the startup steps would, around a
+ * view showing @path, with stub frontend callbacks. */
+static struct browser_view *start_core(QApplication *app, const QString &path) {
+  struct browser_view *view = view_create();
+
+  view->win = open_browser(path);
+  // a scale change reallocates the scaled image, which isn't what's measured
+  view->governor.setRange(100, 100);
+  free(view->frame_buf);
+  view->frame_buf = NULL;
+
+  core = new core_context;
+  core->app = app;
+  core->startup_phase = STARTUP_DONE;
+  core->media_logged = false;
+  core->memory_frames = 0;
+  core->memory_report_level = RETRO_LOG_INFO;
+  core->active = 0;
+  core->views.append(view);
+
+  NETRETROPAD_CORE_PREFIX(environ_cb) = stub_environment;
+  NETRETROPAD_CORE_PREFIX(video_cb) = stub_video_refresh;
+
+  return view;
+}
+
+static MiniBrowser *open_browser(const QString &path) {
+  MiniBrowser *browser = new MiniBrowser;
+  QElapsedTimer timer;
+
+  browser->resize(WIDTH, HEIGHT);
+  browser->setImage(WIDTH, HEIGHT, QImage::Format_RGB32);
+  browser->setCursorEnabled(true);
+  browser->show();
+  browser->activateWindow();
+  browser->newTab(QUrl::fromLocalFile(path));
+
+  timer.start();
+
+  while(!browser->pageLoaded() && timer.elapsed() < BENCH_LOAD_TIMEOUT_MSEC)
+    QCoreApplication::processEvents(QEventLoop::AllEvents, 50);
+
+  // one render so layout and the first paint are not measured
+  browser->render();
+
+  return browser;
+}
+
+static QMap<QString, BenchResult> read_results(const QString &path) {
+  QMap<QString, BenchResult> results;
+  QFile file(path);
+
+  if(!file.open(QIODevice::ReadOnly))
+    return results;
+
+  QTextStream stream(&file);
+
+  // header
+  stream.readLine();
+
+  while(!stream.atEnd()) {
+    QStringList fields = stream.readLine().split(',');
+    BenchResult result;
+
+    if(fields.size() < 7)
+      continue;
+
+    result.name = fields[0];
+    result.samples = fields[1].toInt();
+    result.iterations = fields[2].toLongLong();
+    result.mean = fields[3].toDouble();
+    result.ci = fields[4].toDouble();
+    result.median = fields[5].toDouble();
+    result.min = fields[6].toDouble();
+    result.allocs = fields.size() > 7 ? fields[7].toDouble() : 0.0;
+    results[result.name] = result;
+  }
+
+  return results;
+}
+
+/* A change counts once the two 95% intervals no longer overlap. */
+static void compare(const BenchResult &result, const BenchResult &baseline) {
+  double change = baseline.mean > 0 ? (result.mean - baseline.mean) * 100.0 / baseline.mean : 0.0;
+  bool significant = result.mean - result.ci > baseline.mean + baseline.ci
+      || result.mean + result.ci < baseline.mean - baseline.ci;
+
+  fprintf(stderr, "%-28s %12.1f ns (was %12.1f) %+7.1f%% %s\n", result.name.toUtf8().constData(),
+      result.mean, baseline.mean, change, significant ? (change > 0 ? "slower" : "faster") : "within noise");
+}
+
+int main(int argc, char *argv[])
+{
+  if(qgetenv("QT_QPA_PLATFORM").isEmpty())
+    qputenv("QT_QPA_PLATFORM", "offscreen");
+
+  QApplication a(argc, argv);
+  QCommandLineParser parser;
+  QTemporaryDir dir;
+  QList<Benchmark> benchmarks;
+  QList<MiniBrowser*> browsers;
+  QList<QByteArray> names;
+  QMap<QString, BenchResult> baseline;
+  struct browser_view *view;
+  struct browser_view *runView;
+  int failed = 0;
+
+  parser.setApplicationDescription("Times the core's hot paths and prints the results as CSV.");
+  parser.addHelpOption();
+  parser.addOptions(QList<QCommandLineOption>()
+      << QCommandLineOption("samples", "Samples per benchmark.", "n", "30")
+      << QCommandLineOption("sample-msec", "Shortest time one sample runs for.", "msec", "50")
+      << QCommandLineOption("filter", "Only run benchmarks whose name contains this.", "text")
+      << QCommandLineOption("baseline", "CSV from an earlier run to compare against.", "file"));
+  parser.process(a);
+
+  Q_INIT_RESOURCE(res);
+
+  if(parser.isSet("baseline"))
+    baseline = read_results(parser.value("baseline"));
+
+  QMap<QString, QString> pages = write_pages(dir);
+
+  foreach(const QString &name, pages.keys()) {
+    MiniBrowser *browser = open_browser(pages[name]);
+    Benchmark bench = { 0, bench_render, process_events, browser, true };
+
+    browsers.append(browser);
+    names.append(QString("render/%1").arg(name).toUtf8());
+    bench.name = names.last().constData();
+    benchmarks.append(bench);
+  }
+
+  MiniBrowser *browser = browsers.first();
+
+  handoff_buf = (uint8_t*)malloc(WIDTH * HEIGHT * 4);
+
+  view = view_create();
+  NETRETROPAD_CORE_PREFIX(input_poll_cb) = stub_input_poll;
+  runView = start_core(&a, write_animated_page(dir));
+
+  Benchmark rest[] = {
+    { "cursor_move", bench_cursor, process_events, browser, true },
+    { "get_image", bench_get_image, 0, browser, true },
+    { "frame_handoff", bench_handoff, 0, browser, true },
+    { "on_mouse_input", bench_mouse_input, process_events, browser, true },
+    { "on_retro_key_input", bench_key_input, process_events, browser, true },
+    { "retrokey_to_qt/full_range", bench_retrokey, 0, 0, true },
+    { "retropad_update_input", bench_update_input, 0, view, true },
+    { "retro_run/animated", bench_retro_run, 0, 0, true },
+  };
+
+  for(unsigned i = 0; i < ARRAY_SIZE(rest); i++)
+    benchmarks.append(rest[i]);
+
+  fprintf(stdout, "benchmark,samples,iterations,mean_ns,ci95_ns,median_ns,min_ns,allocs_per_iter\n");
+
+  foreach(const Benchmark &bench, benchmarks) {
+    if(parser.isSet("filter") && !QString(bench.name).contains(parser.value("filter")))
+      continue;
+
+    BenchResult result = measure(bench, qMax(2, parser.value("samples").toInt()), parser.value("sample-msec").toInt());
+
+    fprintf(stdout, "%s,%d,%lld,%.1f,%.1f,%.1f,%.1f,%.3f\n", result.name.toUtf8().constData(), result.samples,
+        (long long)result.iterations, result.mean, result.ci, result.median, result.min, result.allocs);
+    fflush(stdout);
+
+    if(bench.zeroAlloc && result.allocs > 0) {
+      fprintf(stderr, "%-28s allocates %.3f times per iteration in steady state\n",
+          result.name.toUtf8().constData(), result.allocs);
+      failed++;
+    }
+
+    if(baseline.contains(result.name))
+      compare(result, baseline[result.name]);
+  }
+
+  core->views.clear();
+  delete core;
+  core = NULL;
+  view_destroy(runView);
+  view_destroy(view);
+  free(handoff_buf);
+  qDeleteAll(browsers);
+
+  return failed > 0 ? 1 : 0;
+}
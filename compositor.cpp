@@ -0,0 +1,232 @@
+#include "compositor.h"
+
+DamageRects::DamageRects() :
+  m_count(0)
+{
+}
+
+void DamageRects::add(const QRect &rect) {
+  if(rect.isEmpty())
+    return;
+
+  for(int i = 0; i < m_count; i++) {
+    if(m_rects[i].intersects(rect)) {
+      m_rects[i] |= rect;
+      return;
+    }
+  }
+
+  if(m_count < COMPOSITOR_DAMAGE_RECTS) {
+    m_rects[m_count++] = rect;
+    return;
+  }
+
+  for(int i = 1; i < m_count; i++)
+    m_rects[0] |= m_rects[i];
+
+  m_rects[0] |= rect;
+  m_count = 1;
+}
+
+void DamageRects::clear() {
+  m_count = 0;
+}
+
+bool DamageRects::isEmpty() const {
+  return m_count == 0;
+}
+
+int DamageRects::count() const {
+  return m_count;
+}
+
+const QRect& DamageRects::at(int i) const {
+  return m_rects[i];
+}
+
+QRect DamageRects::boundingRect() const {
+  QRect bounds;
+
+  for(int i = 0; i < m_count; i++)
+    bounds |= m_rects[i];
+
+  return bounds;
+}
+
+Compositor::Compositor() :
+  m_layers()
+  ,m_damage()
+  ,m_damageAll(true)
+  ,m_painter()
+{
+}
+
+Compositor::~Compositor()
+{
+  release();
+
+  for(int i = 0; i < m_layers.size(); i++) {
+    endPainter(m_layers[i]);
+    delete m_layers[i].painter;
+  }
+}
+
+/* Layers added later are composed on top. An opaque layer replaces what
+ * is below it instead of being blended. */
+int Compositor::addLayer(bool opaque) {
+  Layer layer;
+
+  layer.painter = 0;
+  layer.opaque = opaque;
+  layer.visible = true;
+  m_layers.append(layer);
+
+  return m_layers.size() - 1;
+}
+
+/* Drawing into the image is up to the caller, and so is calling damage()
+ * for what was drawn. */
+QImage& Compositor::image(int layer) {
+  return m_layers[layer].image;
+}
+
+/* A painter that stays active on the layer's image until the image is
+ * replaced. Callers restore whatever state they change. */
+QPainter* Compositor::painter(int layer) {
+  Layer &l = m_layers[layer];
+
+  if(!l.painter)
+    l.painter = new QPainter;
+
+  if(!l.painter->isActive() && !l.image.isNull())
+    l.painter->begin(&l.image);
+
+  return l.painter;
+}
+
+QRect Compositor::geometry(int layer) const {
+  return QRect(m_layers[layer].pos, m_layers[layer].image.size());
+}
+
+/* Reallocates the layer's image when its size changes; either way the
+ * whole layer has to be drawn again. */
+void Compositor::setGeometry(int layer, const QRect &rect) {
+  Layer &l = m_layers[layer];
+
+  if(geometry(layer) == rect)
+    return;
+
+  m_damage.add(geometry(layer));
+
+  if(l.image.size() != rect.size()) {
+    endPainter(l);
+    l.image = QImage(rect.size(), l.opaque ? QImage::Format_RGB32 : QImage::Format_ARGB32_Premultiplied);
+  }
+
+  l.pos = rect.topLeft();
+  m_damage.add(rect);
+}
+
+void Compositor::setImage(int layer, const QImage &image) {
+  Layer &l = m_layers[layer];
+
+  m_damage.add(geometry(layer));
+  endPainter(l);
+  l.image = l.opaque ? image.convertToFormat(QImage::Format_RGB32) : image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+  m_damage.add(geometry(layer));
+}
+
+void Compositor::setPosition(int layer, const QPoint &pos) {
+  if(m_layers[layer].pos == pos)
+    return;
+
+  m_damage.add(geometry(layer));
+  m_layers[layer].pos = pos;
+  m_damage.add(geometry(layer));
+}
+
+void Compositor::setVisible(int layer, bool visible) {
+  if(m_layers[layer].visible == visible)
+    return;
+
+  m_layers[layer].visible = visible;
+  m_damage.add(geometry(layer));
+}
+
+/* @rect is in the layer's own coordinates. */
+void Compositor::damage(int layer, const QRect &rect) {
+  m_damage.add(rect.translated(m_layers[layer].pos) & geometry(layer));
+}
+
+void Compositor::damage(int layer, const DamageRects &rects) {
+  for(int i = 0; i < rects.count(); i++)
+    damage(layer, rects.at(i));
+}
+
+/* For when the output was replaced. */
+void Compositor::damageAll() {
+  m_damageAll = true;
+}
+
+/* Composes the damaged areas into @target. Copies and blends go through
+ * the raster engine, which has SIMD paths for both. Areas that overlap are
+ * composed twice at worst, which comes out the same since the bottom
+ * layers are opaque. */
+void Compositor::compose(QImage &target) {
+  if(m_damageAll) {
+    m_damage.clear();
+    m_damage.add(target.rect());
+  }
+
+  m_damageAll = false;
+
+  if(m_damage.isEmpty() || target.isNull()) {
+    m_damage.clear();
+    return;
+  }
+
+  if(m_painter.isActive() && m_painter.device() != &target)
+    m_painter.end();
+
+  if(!m_painter.isActive())
+    m_painter.begin(&target);
+
+  for(int i = 0; i < m_damage.count(); i++) {
+    QRect rect = m_damage.at(i) & target.rect();
+
+    for(int j = 0; j < m_layers.size(); j++) {
+      const Layer &layer = m_layers.at(j);
+      QRect area = rect & QRect(layer.pos, layer.image.size());
+
+      if(!layer.visible || area.isEmpty())
+        continue;
+
+      m_painter.setCompositionMode(layer.opaque ? QPainter::CompositionMode_Source : QPainter::CompositionMode_SourceOver);
+      m_painter.drawImage(area.topLeft(), layer.image, area.translated(-layer.pos));
+    }
+  }
+
+  m_damage.clear();
+}
+
+/* Must be called before the output image is replaced or freed. */
+void Compositor::release() {
+  if(m_painter.isActive())
+    m_painter.end();
+
+  m_damageAll = true;
+}
+
+qint64 Compositor::byteCount() const {
+  qint64 bytes = 0;
+
+  foreach(const Layer &layer, m_layers)
+    bytes += layer.image.byteCount();
+
+  return bytes;
+}
+
+void Compositor::endPainter(Layer &layer) {
+  if(layer.painter && layer.painter->isActive())
+    layer.painter->end();
+}
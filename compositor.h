@@ -0,0 +1,79 @@
+#ifndef COMPOSITOR_H
+#define COMPOSITOR_H
+
+#include <QImage>
+#include <QList>
+#include <QPainter>
+#include <QPoint>
+#include <QRect>
+
+/* Damaged areas kept apart before they are merged into one. */
+#define COMPOSITOR_DAMAGE_RECTS 8
+
+/* A fixed set of damaged rectangles. Overlapping ones are merged, and all
+ * of them are folded into one once the set is full, so adding never
+ * allocates. */
+class DamageRects
+{
+public:
+  DamageRects();
+
+  void add(const QRect &rect);
+  void clear();
+  bool isEmpty() const;
+  int count() const;
+  const QRect& at(int i) const;
+  QRect boundingRect() const;
+
+private:
+  QRect m_rects[COMPOSITOR_DAMAGE_RECTS];
+  int m_count;
+};
+
+/* Keeps each part of the frame in an image of its own and composes them,
+ * in the order they were added, into the output. Only what a layer marks
+ * as damaged is composed again; the rest of the output is left alone, so
+ * the output must not be drawn on by anyone else.
+ *
+ * Painters stay active on the output and on the layers between frames,
+ * and damage is kept in a fixed set of rectangles, so composing a frame
+ * allocates nothing. */
+class Compositor
+{
+public:
+  Compositor();
+  ~Compositor();
+
+  int addLayer(bool opaque);
+  QImage& image(int layer);
+  QPainter* painter(int layer);
+  QRect geometry(int layer) const;
+  void setGeometry(int layer, const QRect &rect);
+  void setImage(int layer, const QImage &image);
+  void setPosition(int layer, const QPoint &pos);
+  void setVisible(int layer, bool visible);
+  void damage(int layer, const QRect &rect);
+  void damage(int layer, const DamageRects &rects);
+  void damageAll();
+  void compose(QImage &target);
+  void release();
+  qint64 byteCount() const;
+
+private:
+  struct Layer {
+    QImage image;
+    QPainter *painter;
+    QPoint pos;
+    bool opaque;
+    bool visible;
+  };
+
+  void endPainter(Layer &layer);
+
+  QList<Layer> m_layers;
+  DamageRects m_damage;
+  bool m_damageAll;
+  QPainter m_painter;
+};
+
+#endif // COMPOSITOR_H
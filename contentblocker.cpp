@@ -0,0 +1,539 @@
+#include "contentblocker.h"
+#include <QDir>
+#include <QFile>
+#include <QPair>
+#include <algorithm>
+#include <string.h>
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+/* Patterns whose longest literal is shorter than this are too unselective
+ * to index and are checked against every URL instead. */
+#define MIN_KEYWORD_LENGTH 3
+
+static quint64 hashReversed(const QByteArray &s) {
+  quint64 h = FNV_OFFSET;
+
+  for(int i = s.size() - 1; i >= 0; i--)
+    h = (h ^ (uchar)s.at(i)) * FNV_PRIME;
+
+  return h;
+}
+
+static bool isSeparator(char c) {
+  return !((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') ||
+      c == '_' || c == '-' || c == '.' || c == '%');
+}
+
+static bool isDomain(const QByteArray &s) {
+  if(s.isEmpty())
+    return false;
+
+  for(int i = 0; i < s.size(); i++) {
+    char c = s.at(i);
+
+    if(!((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '-' || c == '.'))
+      return false;
+  }
+
+  return true;
+}
+
+static QByteArray longestLiteral(const QByteArray &pattern) {
+  int best = 0;
+  int bestLen = 0;
+  int start = 0;
+
+  for(int i = 0; i <= pattern.size(); i++) {
+    if(i == pattern.size() || pattern.at(i) == '*' || pattern.at(i) == '^' || pattern.at(i) == '|') {
+      if(i - start > bestLen) {
+        best = start;
+        bestLen = i - start;
+      }
+
+      start = i + 1;
+    }
+  }
+
+  return pattern.mid(best, bestLen);
+}
+
+static bool matchAt(const char *p, const char *pend, const char *s, const char *send, bool anchorEnd) {
+  while(p < pend) {
+    if(*p == '*') {
+      p++;
+
+      if(p == pend)
+        return true;
+
+      for(; s <= send; s++) {
+        if(matchAt(p, pend, s, send, anchorEnd))
+          return true;
+      }
+
+      return false;
+    }
+
+    if(*p == '^') {
+      // a separator placeholder also matches the end of the address
+      if(s == send) {
+        p++;
+        continue;
+      }
+
+      if(!isSeparator(*s))
+        return false;
+    }else if(s == send || *p != *s) {
+      return false;
+    }
+
+    p++;
+    s++;
+  }
+
+  return !anchorEnd || s == send;
+}
+
+ContentBlocker::ContentBlocker()
+{
+}
+
+/* Loads every *.txt list in @path and compiles the result. Returns the
+ * number of rules that were understood. */
+int ContentBlocker::loadDirectory(const QString &path) {
+  QDir dir(path);
+
+  foreach(const QString &name, dir.entryList(QStringList() << "*.txt", QDir::Files, QDir::Name))
+    loadList(dir.filePath(name));
+
+  compile();
+
+  return ruleCount();
+}
+
+/* Adds the rules of one list. compile() must be called before matching. */
+bool ContentBlocker::loadList(const QString &path) {
+  QFile file(path);
+
+  if(!file.open(QIODevice::ReadOnly | QIODevice::Text))
+    return false;
+
+  while(!file.atEnd())
+    addRule(file.readLine());
+
+  return true;
+}
+
+bool ContentBlocker::addRule(QByteArray line) {
+  Matcher *matcher = &m_block;
+  Rule rule;
+  int dollar;
+
+  line = line.trimmed();
+
+  if(line.isEmpty() || line.startsWith('!') || line.startsWith('['))
+    return false;
+
+  // element hiding and scriptlet rules have nothing to do with requests
+  if(line.contains("##") || line.contains("#@#") || line.contains("#?#") || line.contains("#$#"))
+    return false;
+
+  if(line.startsWith("@@")) {
+    matcher = &m_allow;
+    line = line.mid(2);
+  }
+
+  // a rule without types covers everything but the page itself, frames included
+  rule.types = TypeAll & ~TypeDocument;
+  rule.party = PartyAny;
+  rule.anchorStart = false;
+  rule.anchorEnd = false;
+  rule.anchorDomain = false;
+
+  dollar = line.lastIndexOf('$');
+
+  if(dollar >= 0) {
+    if(!parseOptions(line.mid(dollar + 1), rule))
+      return false;
+
+    line.truncate(dollar);
+  }
+
+  // regular expression rules are too slow to evaluate per request
+  if(line.size() > 1 && line.startsWith('/') && line.endsWith('/'))
+    return false;
+
+  line = line.toLower();
+
+  if(line.startsWith("||")) {
+    rule.anchorDomain = true;
+    line = line.mid(2);
+  }else if(line.startsWith('|')) {
+    rule.anchorStart = true;
+    line = line.mid(1);
+  }
+
+  if(line.endsWith('|')) {
+    rule.anchorEnd = true;
+    line.chop(1);
+  }
+
+  while(line.startsWith('*')) {
+    rule.anchorStart = false;
+    rule.anchorDomain = false;
+    line = line.mid(1);
+  }
+
+  while(line.endsWith('*')) {
+    rule.anchorEnd = false;
+    line.chop(1);
+  }
+
+  // an empty pattern would block everything
+  if(line.isEmpty())
+    return false;
+
+  rule.pattern = line;
+  matcher->rules.append(rule);
+
+  if(rule.anchorDomain && !rule.anchorEnd && line.endsWith('^') && isDomain(line.left(line.size() - 1))) {
+    matcher->domains.insertMulti(hashReversed(line.left(line.size() - 1)), matcher->rules.size() - 1);
+    matcher->keywords.append(QByteArray());
+    return true;
+  }
+
+  QByteArray keyword = longestLiteral(line);
+
+  if(keyword.size() < MIN_KEYWORD_LENGTH) {
+    matcher->generic.append(matcher->rules.size() - 1);
+    keyword.clear();
+  }
+
+  matcher->keywords.append(keyword);
+
+  return true;
+}
+
+void ContentBlocker::compile() {
+  m_block.compile();
+  m_allow.compile();
+}
+
+void ContentBlocker::clear() {
+  m_block.clear();
+  m_allow.clear();
+}
+
+bool ContentBlocker::isEmpty() const {
+  return m_block.rules.isEmpty();
+}
+
+int ContentBlocker::ruleCount() const {
+  return m_block.rules.size() + m_allow.rules.size();
+}
+
+/* @url and @host must already be lower case. */
+bool ContentBlocker::shouldBlock(const QByteArray &url, const QByteArray &host, int type, bool thirdParty) const {
+  int hostStart = url.indexOf("://");
+  int at;
+
+  hostStart = hostStart < 0 ? 0 : hostStart + 3;
+  at = url.indexOf(host, hostStart);
+
+  if(at >= 0)
+    hostStart = at;
+
+  if(!m_block.match(url, hostStart, hostStart + host.size(), host, type, thirdParty))
+    return false;
+
+  return !m_allow.match(url, hostStart, hostStart + host.size(), host, type, thirdParty);
+}
+
+bool ContentBlocker::parseOptions(const QByteArray &options, Rule &rule) {
+  int include = 0;
+  int exclude = 0;
+
+  foreach(QByteArray option, options.split(',')) {
+    bool negate = option.startsWith('~');
+    int type;
+
+    if(negate)
+      option = option.mid(1);
+
+    if(option == "third-party" || option == "3p") {
+      rule.party = negate ? PartyFirst : PartyThird;
+      continue;
+    }
+
+    if(option == "first-party" || option == "1p") {
+      rule.party = negate ? PartyThird : PartyFirst;
+      continue;
+    }
+
+    if(option == "match-case")
+      continue;
+
+    if(option == "script")
+      type = TypeScript;
+    else if(option == "image")
+      type = TypeImage;
+    else if(option == "stylesheet")
+      type = TypeStylesheet;
+    else if(option == "font")
+      type = TypeFont;
+    else if(option == "media")
+      type = TypeMedia;
+    else if(option == "subdocument")
+      type = TypeSubdocument;
+    else if(option == "object" || option == "xmlhttprequest" || option == "other" || option == "ping" || option == "websocket")
+      type = TypeOther;
+    else
+      return false; // domain=, popup, csp=, redirect= and friends are not supported
+
+    if(negate)
+      exclude |= type;
+    else
+      include |= type;
+  }
+
+  if(include)
+    rule.types = include;
+
+  rule.types &= ~exclude;
+
+  return rule.types != 0;
+}
+
+bool ContentBlocker::ruleApplies(const Rule &rule, int type, bool thirdParty) {
+  if(!(rule.types & type))
+    return false;
+
+  if(rule.party == PartyThird)
+    return thirdParty;
+
+  if(rule.party == PartyFirst)
+    return !thirdParty;
+
+  return true;
+}
+
+bool ContentBlocker::matchRule(const Rule &rule, const QByteArray &url, int hostStart, int hostEnd) {
+  const char *p = rule.pattern.constData();
+  const char *pend = p + rule.pattern.size();
+  const char *s = url.constData();
+  const char *send = s + url.size();
+
+  if(rule.anchorDomain) {
+    for(int i = hostStart; i < hostEnd; i++) {
+      if((i == hostStart || s[i - 1] == '.') && matchAt(p, pend, s + i, send, rule.anchorEnd))
+        return true;
+    }
+
+    return false;
+  }
+
+  if(rule.anchorStart)
+    return matchAt(p, pend, s, send, rule.anchorEnd);
+
+  for(; s <= send; s++) {
+    if(matchAt(p, pend, s, send, rule.anchorEnd))
+      return true;
+  }
+
+  return false;
+}
+
+void ContentBlocker::Matcher::clear() {
+  rules.clear();
+  keywords.clear();
+  generic.clear();
+  domains.clear();
+  rootNext.clear();
+  fail.clear();
+  dictLink.clear();
+  edgeFirst.clear();
+  edgeCount.clear();
+  edgeBytes.clear();
+  edgeTargets.clear();
+  outFirst.clear();
+  outCount.clear();
+  outRules.clear();
+}
+
+/* Builds the keyword trie, flattens it into sorted edge arrays and links
+ * failure/dictionary suffixes. The root keeps a dense table since nearly
+ * every mismatch falls back to it. */
+void ContentBlocker::Matcher::compile() {
+  QHash<quint32, int> edges;
+  QVector<QPair<int, int> > outputs;
+  QVector<quint64> packed;
+  QVector<int> queue;
+  int nodes = 1;
+
+  for(int i = 0; i < keywords.size(); i++) {
+    const QByteArray &keyword = keywords.at(i);
+    int node = 0;
+
+    if(keyword.isEmpty())
+      continue;
+
+    for(int j = 0; j < keyword.size(); j++) {
+      quint32 key = ((quint32)node << 8) | (uchar)keyword.at(j);
+      QHash<quint32, int>::const_iterator it = edges.constFind(key);
+
+      if(it == edges.constEnd()) {
+        edges.insert(key, nodes);
+        node = nodes++;
+      }else{
+        node = it.value();
+      }
+    }
+
+    outputs.append(qMakePair(node, i));
+  }
+
+  rootNext.fill(0, 256);
+  fail.fill(0, nodes);
+  dictLink.fill(0, nodes);
+  edgeFirst.fill(0, nodes);
+  edgeCount.fill(0, nodes);
+  outFirst.fill(0, nodes);
+  outCount.fill(0, nodes);
+
+  packed.reserve(edges.size());
+
+  for(QHash<quint32, int>::const_iterator it = edges.constBegin(); it != edges.constEnd(); ++it)
+    packed.append(((quint64)it.key() << 32) | (quint32)it.value());
+
+  std::sort(packed.begin(), packed.end());
+
+  edgeBytes.resize(packed.size());
+  edgeTargets.resize(packed.size());
+
+  for(int i = 0; i < packed.size(); i++) {
+    int node = (int)(packed.at(i) >> 40);
+    uchar c = (uchar)(packed.at(i) >> 32);
+    int child = (int)(packed.at(i) & 0xffffffff);
+
+    if(edgeCount[node] == 0)
+      edgeFirst[node] = i;
+
+    edgeCount[node]++;
+    edgeBytes[i] = c;
+    edgeTargets[i] = child;
+
+    if(node == 0)
+      rootNext[c] = child;
+  }
+
+  std::sort(outputs.begin(), outputs.end());
+  outRules.resize(outputs.size());
+
+  for(int i = 0; i < outputs.size(); i++) {
+    int node = outputs.at(i).first;
+
+    if(outCount[node] == 0)
+      outFirst[node] = i;
+
+    outCount[node]++;
+    outRules[i] = outputs.at(i).second;
+  }
+
+  queue.reserve(nodes);
+
+  for(int i = 0; i < edgeCount[0]; i++)
+    queue.append(edgeTargets[edgeFirst[0] + i]);
+
+  for(int i = 0; i < queue.size(); i++) {
+    int r = queue.at(i);
+
+    for(int e = edgeFirst[r]; e < edgeFirst[r] + edgeCount[r]; e++) {
+      uchar c = edgeBytes[e];
+      int u = edgeTargets[e];
+      int f = fail[r];
+      int v;
+
+      queue.append(u);
+
+      while((v = step(f, c)) < 0)
+        f = fail[f];
+
+      fail[u] = v;
+      dictLink[u] = outCount[v] ? v : dictLink[v];
+    }
+  }
+}
+
+/* Follows the edge for @c out of @node. The root never fails: a missing
+ * edge there just stays at the root. */
+int ContentBlocker::Matcher::step(int node, uchar c) const {
+  if(node == 0)
+    return rootNext[c];
+
+  for(int e = edgeFirst[node]; e < edgeFirst[node] + edgeCount[node]; e++) {
+    if(edgeBytes[e] == c)
+      return edgeTargets[e];
+  }
+
+  return -1;
+}
+
+bool ContentBlocker::Matcher::match(const QByteArray &url, int hostStart, int hostEnd, const QByteArray &host, int type, bool thirdParty) const {
+  if(!domains.isEmpty()) {
+    quint64 h = FNV_OFFSET;
+
+    // hash the host from the right, probing at every label boundary
+    for(int i = host.size() - 1; i >= 0; i--) {
+      h = (h ^ (uchar)host.at(i)) * FNV_PRIME;
+
+      if(i > 0 && host.at(i - 1) != '.')
+        continue;
+
+      for(QHash<quint64, int>::const_iterator it = domains.constFind(h); it != domains.constEnd() && it.key() == h; ++it) {
+        const Rule &rule = rules.at(it.value());
+        int length = rule.pattern.size() - 1;
+
+        // the pattern is the domain followed by '^'; a colliding hash is no match
+        if(host.size() - i != length || memcmp(host.constData() + i, rule.pattern.constData(), length) != 0)
+          continue;
+
+        if(ruleApplies(rule, type, thirdParty))
+          return true;
+      }
+    }
+  }
+
+  for(int i = 0; i < generic.size(); i++) {
+    const Rule &rule = rules.at(generic.at(i));
+
+    if(ruleApplies(rule, type, thirdParty) && matchRule(rule, url, hostStart, hostEnd))
+      return true;
+  }
+
+  if(fail.isEmpty())
+    return false;
+
+  int state = 0;
+
+  for(int i = 0; i < url.size(); i++) {
+    uchar c = (uchar)url.at(i);
+    int next;
+
+    while((next = step(state, c)) < 0)
+      state = fail[state];
+
+    state = next;
+
+    for(int n = outCount[state] ? state : dictLink[state]; n > 0; n = dictLink[n]) {
+      for(int o = outFirst[n]; o < outFirst[n] + outCount[n]; o++) {
+        const Rule &rule = rules.at(outRules[o]);
+
+        if(ruleApplies(rule, type, thirdParty) && matchRule(rule, url, hostStart, hostEnd))
+          return true;
+      }
+    }
+  }
+
+  return false;
+}
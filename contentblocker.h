@@ -0,0 +1,87 @@
+#ifndef CONTENTBLOCKER_H
+#define CONTENTBLOCKER_H
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+#include <QHash>
+
+/* Matches request URLs against EasyList-style filter lists. Rules that only
+ * name a domain ("||ads.example.com^") go into a hash set keyed by domain
+ * suffix and checked against the domain on a hit; everything else is found through an Aho-Corasick automaton over
+ * the longest literal of each pattern and then verified in full. */
+class ContentBlocker
+{
+public:
+  enum ResourceType {
+    TypeDocument = 1 << 0,
+    TypeStylesheet = 1 << 1,
+    TypeScript = 1 << 2,
+    TypeFont = 1 << 3,
+    TypeImage = 1 << 4,
+    TypeMedia = 1 << 5,
+    TypeOther = 1 << 6,
+    TypeSubdocument = 1 << 7,
+    TypeAll = (1 << 8) - 1
+  };
+
+  ContentBlocker();
+
+  int loadDirectory(const QString &path);
+  bool loadList(const QString &path);
+  bool addRule(QByteArray line);
+  void compile();
+  void clear();
+
+  bool isEmpty() const;
+  int ruleCount() const;
+  bool shouldBlock(const QByteArray &url, const QByteArray &host, int type, bool thirdParty) const;
+
+private:
+  enum Party {
+    PartyAny,
+    PartyThird,
+    PartyFirst
+  };
+
+  struct Rule {
+    QByteArray pattern;
+    int types;
+    int party;
+    bool anchorStart;
+    bool anchorEnd;
+    bool anchorDomain;
+  };
+
+  struct Matcher {
+    QVector<Rule> rules;
+    QVector<QByteArray> keywords;
+    QVector<int> generic;
+    QHash<quint64, int> domains;
+
+    QVector<int> rootNext;
+    QVector<int> fail;
+    QVector<int> dictLink;
+    QVector<int> edgeFirst;
+    QVector<int> edgeCount;
+    QVector<uchar> edgeBytes;
+    QVector<int> edgeTargets;
+    QVector<int> outFirst;
+    QVector<int> outCount;
+    QVector<int> outRules;
+
+    void clear();
+    void compile();
+    int step(int node, uchar c) const;
+    bool match(const QByteArray &url, int hostStart, int hostEnd, const QByteArray &host, int type, bool thirdParty) const;
+  };
+
+  static bool parseOptions(const QByteArray &options, Rule &rule);
+  static bool ruleApplies(const Rule &rule, int type, bool thirdParty);
+  static bool matchRule(const Rule &rule, const QByteArray &url, int hostStart, int hostEnd);
+
+  Matcher m_block;
+  Matcher m_allow;
+};
+
+#endif // CONTENTBLOCKER_H
@@ -0,0 +1,270 @@
+#include "corelog.h"
+#include <QThread>
+#include <QMutex>
+#include <QFile>
+#include <QElapsedTimer>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Slots in the queue; must be a power of two. */
+#define LOG_QUEUE_SIZE 256
+/* Longer messages are cut off. */
+#define LOG_TEXT_SIZE 512
+/* How often the background thread empties the queue. */
+#define LOG_DRAIN_MSEC 20
+
+struct LogEntry {
+  QAtomicInt sequence;
+  int position;
+  int level;
+  const LogSite *site;
+  int suppressed;
+  qint64 usec;
+  char text[LOG_TEXT_SIZE];
+};
+
+/* A bounded queue for any number of writers and one reader. Every slot
+ * carries a sequence number that says whose turn it is: a writer claims a
+ * slot by moving the head past it, and the reader only takes slots whose
+ * writer has published them. Nobody ever waits on anybody else. */
+class LogQueue
+{
+public:
+  LogQueue() :
+    m_head(0)
+    ,m_tail(0)
+  {
+    for(int i = 0; i < LOG_QUEUE_SIZE; i++)
+      m_entries[i].sequence.store(i);
+  }
+
+  /* Returns 0 when the queue is full. */
+  LogEntry* claim() {
+    int pos = m_head.load();
+
+    for(;;) {
+      LogEntry *entry = &m_entries[pos & (LOG_QUEUE_SIZE - 1)];
+      int diff = (int)((uint)entry->sequence.loadAcquire() - (uint)pos);
+
+      if(diff == 0) {
+        if(m_head.testAndSetRelaxed(pos, pos + 1)) {
+          entry->position = pos;
+          return entry;
+        }
+      }else if(diff < 0) {
+        return 0;
+      }
+
+      pos = m_head.load();
+    }
+  }
+
+  void publish(LogEntry *entry) {
+    entry->sequence.storeRelease(entry->position + 1);
+  }
+
+  /* Reader only. */
+  LogEntry* next() {
+    LogEntry *entry = &m_entries[m_tail & (LOG_QUEUE_SIZE - 1)];
+
+    if((int)((uint)entry->sequence.loadAcquire() - (uint)(m_tail + 1)) < 0)
+      return 0;
+
+    return entry;
+  }
+
+  void release(LogEntry *entry) {
+    entry->sequence.storeRelease(m_tail + LOG_QUEUE_SIZE);
+    m_tail++;
+  }
+
+private:
+  QAtomicInt m_head;
+  int m_tail;
+  LogEntry m_entries[LOG_QUEUE_SIZE];
+};
+
+class LogDrain : public QThread
+{
+protected:
+  void run();
+};
+
+static LogQueue log_queue;
+static LogDrain *log_drain;
+static retro_log_printf_t log_sink;
+static QAtomicInt log_stopping;
+static QAtomicInt log_dropped;
+static QElapsedTimer log_clock;
+static QMutex log_file_lock;
+static QFile log_file;
+
+QAtomicInt CoreLog::s_level(RETRO_LOG_INFO);
+
+static const char* level_name(int level) {
+  switch(level) {
+    case RETRO_LOG_DEBUG:
+      return "debug";
+    case RETRO_LOG_INFO:
+      return "info";
+    case RETRO_LOG_WARN:
+      return "warn";
+    default:
+      return "error";
+  }
+}
+
+static const char* site_name(const LogSite *site) {
+  const char *name = strrchr(site->file, '/');
+
+  return name ? name + 1 : site->file;
+}
+
+/* Lets through the first CORE_LOG_SITE_RATE messages of every second. */
+static bool admit(LogSite *site, int second) {
+  int last = site->second.load();
+
+  if(last != second && site->second.testAndSetRelaxed(last, second))
+    site->count.store(0);
+
+  if(site->count.fetchAndAddRelaxed(1) < CORE_LOG_SITE_RATE)
+    return true;
+
+  site->suppressed.ref();
+  return false;
+}
+
+static void write_json(const LogEntry &entry) {
+  QByteArray line;
+  QByteArray text(entry.text);
+
+  while(text.endsWith('\n'))
+    text.chop(1);
+
+  text.replace('\\', "\\\\").replace('"', "\\\"").replace('\n', "\\n").replace('\t', "\\t");
+
+  line = QString("{\"usec\":%1,\"level\":\"%2\",\"site\":\"%3:%4\",\"suppressed\":%5,\"message\":\"")
+      .arg(entry.usec).arg(level_name(entry.level)).arg(site_name(entry.site)).arg(entry.site->line)
+      .arg(entry.suppressed).toUtf8();
+  line += text + "\"}\n";
+
+  log_file.write(line);
+}
+
+static void deliver(const LogEntry &entry) {
+  if(log_sink) {
+    if(entry.suppressed > 0)
+      log_sink((enum retro_log_level)entry.level, "(%d more from %s:%d suppressed)\n",
+          entry.suppressed, site_name(entry.site), entry.site->line);
+
+    log_sink((enum retro_log_level)entry.level, "%s", entry.text);
+  }
+
+  QMutexLocker locker(&log_file_lock);
+
+  if(log_file.isOpen())
+    write_json(entry);
+}
+
+static void drain() {
+  LogEntry *entry;
+  int lost;
+
+  while((entry = log_queue.next())) {
+    deliver(*entry);
+    log_queue.release(entry);
+  }
+
+  lost = log_dropped.fetchAndStoreRelaxed(0);
+
+  if(lost > 0 && log_sink)
+    log_sink(RETRO_LOG_WARN, "Log queue full, dropped %d messages.\n", lost);
+
+  QMutexLocker locker(&log_file_lock);
+
+  if(log_file.isOpen())
+    log_file.flush();
+}
+
+void LogDrain::run() {
+  while(!log_stopping.load()) {
+    drain();
+    msleep(LOG_DRAIN_MSEC);
+  }
+
+  drain();
+}
+
+/* Messages written before this wait in the queue. */
+void CoreLog::start(retro_log_printf_t logger) {
+  if(log_drain)
+    return;
+
+  log_sink = logger;
+  log_stopping.store(0);
+  log_clock.start();
+
+  log_drain = new LogDrain;
+  log_drain->start(QThread::LowPriority);
+}
+
+/* Delivers whatever is still queued before returning. */
+void CoreLog::stop() {
+  if(!log_drain)
+    return;
+
+  log_stopping.store(1);
+  log_drain->wait();
+  delete log_drain;
+  log_drain = 0;
+
+  setFile(QString());
+}
+
+void CoreLog::setLevel(int level) {
+  s_level.store(level);
+}
+
+/* Appends the JSON lines to @path; an empty path stops writing them. */
+void CoreLog::setFile(const QString &path) {
+  QMutexLocker locker(&log_file_lock);
+
+  if(log_file.isOpen() && log_file.fileName() == path)
+    return;
+
+  log_file.close();
+
+  if(path.isEmpty())
+    return;
+
+  log_file.setFileName(path);
+  log_file.open(QIODevice::WriteOnly | QIODevice::Append);
+}
+
+void CoreLog::write(LogSite *site, int level, const char *format, ...) {
+  LogEntry *entry;
+  va_list args;
+  qint64 usec = log_clock.isValid() ? log_clock.nsecsElapsed() / 1000 : 0;
+
+  if(!admit(site, (int)(usec / 1000000)))
+    return;
+
+  entry = log_queue.claim();
+
+  if(!entry) {
+    log_dropped.ref();
+    return;
+  }
+
+  entry->level = level;
+  entry->site = site;
+  entry->suppressed = site->suppressed.fetchAndStoreRelaxed(0);
+  entry->usec = usec;
+
+  va_start(args, format);
+  vsnprintf(entry->text, LOG_TEXT_SIZE, format, args);
+  va_end(args);
+
+  log_queue.publish(entry);
+}
@@ -0,0 +1,73 @@
+#ifndef CORELOG_H
+#define CORELOG_H
+
+#include <QAtomicInt>
+#include <QString>
+#include "libretro.h"
+
+/* Messages below this level are compiled out entirely. */
+#ifndef CORE_LOG_MIN_LEVEL
+#define CORE_LOG_MIN_LEVEL RETRO_LOG_DEBUG
+#endif
+
+/* Messages a single call site may log per second; the rest are counted
+ * and reported with the next one that gets through. */
+#define CORE_LOG_SITE_RATE 10
+
+/* Logs a printf-style message through the frontend without waiting on it.
+ * A disabled level costs one relaxed load, an enabled one the formatting
+ * and a slot in the queue; the frontend is called from a background
+ * thread. */
+#define CORE_LOG(level, ...) \
+  do { \
+    if((level) >= CORE_LOG_MIN_LEVEL && (int)(level) >= CoreLog::level()) { \
+      static LogSite core_log_site(__FILE__, __LINE__); \
+      CoreLog::write(&core_log_site, (level), __VA_ARGS__); \
+    } \
+  } while(0)
+
+/* Per call site state. Constant-initialized, so the static in CORE_LOG
+ * needs no guard. */
+struct LogSite {
+  Q_DECL_CONSTEXPR LogSite(const char *file, int line) :
+  file(file)
+  ,line(line)
+  ,second(-1)
+  ,count(0)
+  ,suppressed(0)
+  {}
+
+  const char *file;
+  int line;
+  QAtomicInt second;
+  QAtomicInt count;
+  QAtomicInt suppressed;
+};
+
+/* Queued messages are handed to the frontend's log interface by a
+ * background thread, and can also be written as JSON lines, one object
+ * per message with its time, level, call site and suppressed count. When
+ * the queue is full, messages are dropped rather than waited for. */
+class CoreLog
+{
+public:
+  static void start(retro_log_printf_t sink);
+  static void stop();
+  static void setLevel(int level);
+  static void setFile(const QString &path);
+
+  static inline int level() {
+    return s_level.load();
+  }
+
+  static void write(LogSite *site, int level, const char *format, ...)
+#ifdef __GNUC__
+    __attribute__((format(printf, 3, 4)))
+#endif
+    ;
+
+private:
+  static QAtomicInt s_level;
+};
+
+#endif // CORELOG_H
@@ -0,0 +1,163 @@
+#include "framepacer.h"
+#include <math.h>
+
+#define PACER_MAX_RATE 60.0
+#define PACER_IDLE_RATE 30.0
+
+/* Updates per second below which a page counts as idle. A focused text
+ * field blinking its caret stays under this. */
+#define PACER_IDLE_UPDATES 3.0
+
+#define PACER_WINDOW_MSEC 1000
+/* Consecutive windows a new rate must be chosen in before switching. */
+#define PACER_STABLE_WINDOWS 2
+#define PACER_MIN_INTERVAL_MSEC 5000
+
+/* How far, in percent, a measured video rate may be off a known cadence. */
+#define PACER_CADENCE_TOLERANCE 10
+
+/* How long a video stays at a reduced rate before the full rate is tried
+ * again to see whether it is faster; doubled every time it turns out not
+ * to be. */
+#define PACER_PROBE_MSEC 10000
+#define PACER_PROBE_MAX_MSEC 300000
+
+static const double cadences[] = { 24.0, 25.0, 30.0, 50.0, 60.0 };
+
+FramePacer::FramePacer() :
+  m_enabled(false)
+  ,m_refused(false)
+  ,m_rate(PACER_MAX_RATE)
+  ,m_candidate(PACER_MAX_RATE)
+  ,m_proposed(PACER_MAX_RATE)
+  ,m_probedFrom(0.0)
+  ,m_stable(0)
+  ,m_updates(0)
+  ,m_video(false)
+  ,m_probeMsec(PACER_PROBE_MSEC)
+  ,m_window()
+  ,m_lastChange()
+{
+}
+
+/* Has no effect once the frontend has refused a rate. */
+void FramePacer::setEnabled(bool on) {
+  m_enabled = on && !m_refused;
+}
+
+double FramePacer::rate() const {
+  return m_rate;
+}
+
+/* Called once per output frame with the number of repaints the page asked
+ * for since the last one. Returns true when a new rate is proposed; the
+ * caller answers with accept() or refuse(). */
+bool FramePacer::sample(int updates, bool video) {
+  qint64 elapsed;
+  double target;
+
+  if(m_refused)
+    return false;
+
+  m_updates += updates;
+  m_video = m_video || video;
+
+  if(!m_window.isValid()) {
+    m_window.start();
+    return false;
+  }
+
+  elapsed = m_window.elapsed();
+
+  if(elapsed < PACER_WINDOW_MSEC)
+    return false;
+
+  target = m_enabled ? choose(m_updates * 1000.0 / elapsed, m_video) : PACER_MAX_RATE;
+
+  m_updates = 0;
+  m_video = false;
+  m_window.start();
+
+  if(target == m_rate) {
+    m_stable = 0;
+    return false;
+  }
+
+  if(target != m_candidate) {
+    m_candidate = target;
+    m_stable = 0;
+  }
+
+  // turning pacing off goes back to the full rate straight away
+  if(m_enabled) {
+    if(++m_stable < PACER_STABLE_WINDOWS)
+      return false;
+
+    if(m_lastChange.isValid() && m_lastChange.elapsed() < PACER_MIN_INTERVAL_MSEC)
+      return false;
+  }
+
+  m_proposed = target;
+  m_stable = 0;
+
+  return true;
+}
+
+double FramePacer::proposed() const {
+  return m_proposed;
+}
+
+/* The frontend runs at proposed() from now on. A probe that comes back to
+ * the rate it left waits twice as long before the next one. */
+void FramePacer::accept() {
+  if(m_rate < PACER_MAX_RATE && m_proposed == PACER_MAX_RATE)
+    m_probedFrom = m_rate;
+  else if(m_proposed == m_probedFrom)
+    m_probeMsec = qMin(m_probeMsec * 2, (qint64)PACER_PROBE_MAX_MSEC);
+  else
+    m_probeMsec = PACER_PROBE_MSEC;
+
+  if(m_proposed != PACER_MAX_RATE && m_proposed != m_probedFrom)
+    m_probedFrom = 0.0;
+
+  m_rate = m_proposed;
+  m_lastChange.start();
+}
+
+/* The frontend stays at rate(). It is not asked again, whatever the core
+ * option says later. */
+void FramePacer::refuse() {
+  m_refused = true;
+  m_enabled = false;
+  m_proposed = m_rate;
+}
+
+/* Updates coalesce per output frame, so the measured rate never exceeds the
+ * current one. A video that keeps up with a reduced rate may well be faster,
+ * so now and then the full rate is tried again to find out. */
+double FramePacer::choose(double measured, bool video) const {
+  double best = PACER_MAX_RATE;
+  double distance = -1.0;
+  unsigned i;
+
+  if(video) {
+    for(i = 0; i < sizeof(cadences) / sizeof(cadences[0]); i++) {
+      double off = fabs(measured - cadences[i]);
+
+      if(off <= cadences[i] * PACER_CADENCE_TOLERANCE / 100 && (distance < 0 || off < distance)) {
+        best = cadences[i];
+        distance = off;
+      }
+    }
+
+    if(best == m_rate && m_rate < PACER_MAX_RATE && m_lastChange.isValid() && m_lastChange.elapsed() >= m_probeMsec)
+      return PACER_MAX_RATE;
+
+    return best;
+  }
+
+  if(measured < PACER_IDLE_UPDATES)
+    return PACER_IDLE_RATE;
+
+  return PACER_MAX_RATE;
+}
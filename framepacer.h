@@ -0,0 +1,42 @@
+#ifndef FRAMEPACER_H
+#define FRAMEPACER_H
+
+#include <QtGlobal>
+#include <QElapsedTimer>
+
+/* Picks the output frame rate from how often the page actually changes. A
+ * playing video is matched to its cadence, a page that barely repaints
+ * drops to a lower rate, and anything else runs at the full rate. A new
+ * rate has to hold for a while before it is proposed, since renegotiating
+ * it is expensive for the frontend, and only becomes rate() once the
+ * frontend has accepted it. */
+class FramePacer
+{
+public:
+  FramePacer();
+
+  void setEnabled(bool on);
+  bool sample(int updates, bool video);
+  double proposed() const;
+  void accept();
+  void refuse();
+  double rate() const;
+
+private:
+  double choose(double measured, bool video) const;
+
+  bool m_enabled;
+  bool m_refused;
+  double m_rate;
+  double m_candidate;
+  double m_proposed;
+  double m_probedFrom;
+  int m_stable;
+  int m_updates;
+  bool m_video;
+  qint64 m_probeMsec;
+  QElapsedTimer m_window;
+  QElapsedTimer m_lastChange;
+};
+
+#endif // FRAMEPACER_H
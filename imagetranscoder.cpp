@@ -0,0 +1,42 @@
+#include "imagetranscoder.h"
+#include <QBuffer>
+#include <QImage>
+#include <QImageReader>
+
+#define TRANSCODE_JPEG_QUALITY 85
+
+ImageTranscoder::ImageTranscoder(int id, const QByteArray &data, const QSize &size, QObject *parent) :
+  QObject(parent)
+  ,m_id(id)
+  ,m_data(data)
+  ,m_size(size)
+{
+  // the manager deletes us once the result has been delivered
+  setAutoDelete(false);
+}
+
+void ImageTranscoder::run() {
+  QBuffer input(&m_data);
+  QImageReader reader(&input);
+  QByteArray output;
+  QByteArray contentType;
+
+  // lets the JPEG decoder scale in the DCT instead of decoding at full size
+  reader.setScaledSize(m_size);
+
+  QImage image = reader.read();
+
+  if(!image.isNull()) {
+    QBuffer buffer(&output);
+    bool alpha = image.hasAlphaChannel();
+
+    buffer.open(QIODevice::WriteOnly);
+
+    if(image.save(&buffer, alpha ? "PNG" : "JPEG", alpha ? -1 : TRANSCODE_JPEG_QUALITY))
+      contentType = alpha ? "image/png" : "image/jpeg";
+    else
+      output.clear();
+  }
+
+  emit done(m_id, output, contentType);
+}
@@ -0,0 +1,30 @@
+#ifndef IMAGETRANSCODER_H
+#define IMAGETRANSCODER_H
+
+#include <QObject>
+#include <QRunnable>
+#include <QByteArray>
+#include <QSize>
+
+/* Decodes an encoded image straight to a smaller size and encodes it again,
+ * on a pool thread. Emits an empty body if the image could not be decoded so
+ * the caller can fall back to the original. */
+class ImageTranscoder : public QObject, public QRunnable
+{
+  Q_OBJECT
+
+public:
+  ImageTranscoder(int id, const QByteArray &data, const QSize &size, QObject *parent = 0);
+
+  void run();
+
+signals:
+  void done(int id, const QByteArray &data, const QByteArray &contentType);
+
+private:
+  int m_id;
+  QByteArray m_data;
+  QSize m_size;
+};
+
+#endif // IMAGETRANSCODER_H
@@ -0,0 +1,201 @@
+#include "inputrecorder.h"
+
+#define INPUT_LOG_MAGIC 0x4d424952
+#define INPUT_LOG_VERSION 1
+
+/* Per-frame counts are stored in a byte; a frame never sees more changes
+ * than a view has inputs, but keys could in theory pile up. */
+#define INPUT_LOG_MAX_ENTRIES 255
+
+InputRecorder::InputRecorder() :
+  m_mode(ModeOff)
+  ,m_file()
+  ,m_stream()
+  ,m_session()
+  ,m_epoch(0)
+  ,m_seed(0)
+  ,m_clock(0)
+  ,m_frames(0)
+  ,m_pending()
+{
+}
+
+InputRecorder::~InputRecorder()
+{
+  stop();
+}
+
+bool InputRecorder::record(const QString &path, const QByteArray &session, qint64 epoch, quint32 seed) {
+  stop();
+
+  m_file.setFileName(path);
+
+  if(!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    return false;
+
+  m_stream.setDevice(&m_file);
+  m_stream.setVersion(QDataStream::Qt_5_0);
+  m_stream << (quint32)INPUT_LOG_MAGIC << (quint32)INPUT_LOG_VERSION << epoch << seed << session;
+
+  m_mode = ModeRecord;
+  m_session = session;
+  m_epoch = epoch;
+  m_seed = seed;
+  m_clock = 0;
+  m_frames = 0;
+  m_pending = Frame();
+
+  return true;
+}
+
+bool InputRecorder::replay(const QString &path) {
+  quint32 magic = 0;
+  quint32 version = 0;
+
+  stop();
+
+  m_file.setFileName(path);
+
+  if(!m_file.open(QIODevice::ReadOnly))
+    return false;
+
+  m_stream.setDevice(&m_file);
+  m_stream.setVersion(QDataStream::Qt_5_0);
+  m_stream >> magic >> version >> m_epoch >> m_seed >> m_session;
+
+  if(magic != INPUT_LOG_MAGIC || version != INPUT_LOG_VERSION || m_stream.status() != QDataStream::Ok) {
+    m_stream.setDevice(0);
+    m_file.close();
+    return false;
+  }
+
+  m_mode = ModeReplay;
+  m_clock = 0;
+  m_frames = 0;
+
+  return true;
+}
+
+void InputRecorder::stop() {
+  if(m_mode == ModeOff)
+    return;
+
+  m_stream.setDevice(0);
+  m_file.close();
+  m_mode = ModeOff;
+}
+
+InputRecorder::Mode InputRecorder::mode() const {
+  return m_mode;
+}
+
+QByteArray InputRecorder::session() const {
+  return m_session;
+}
+
+qint64 InputRecorder::epoch() const {
+  return m_epoch;
+}
+
+quint32 InputRecorder::seed() const {
+  return m_seed;
+}
+
+int InputRecorder::frames() const {
+  return m_frames;
+}
+
+/* Time of the last frame written or read, in msec since the start. */
+qint64 InputRecorder::clock() const {
+  return m_clock;
+}
+
+void InputRecorder::addChange(quint8 device, quint16 offset, quint16 value) {
+  Change change;
+
+  if(m_mode != ModeRecord || m_pending.changes.size() >= INPUT_LOG_MAX_ENTRIES)
+    return;
+
+  change.device = device;
+  change.offset = offset;
+  change.value = value;
+  m_pending.changes.append(change);
+}
+
+void InputRecorder::addKey(bool down, quint16 keycode, quint32 character, quint16 mod) {
+  Key key;
+
+  if(m_mode != ModeRecord || m_pending.keys.size() >= INPUT_LOG_MAX_ENTRIES)
+    return;
+
+  key.down = down;
+  key.keycode = keycode;
+  key.character = character;
+  key.mod = mod;
+  m_pending.keys.append(key);
+}
+
+/* Writes out everything added since the last frame. The clock is stored as
+ * the distance to the previous frame, which always fits 16 bits in
+ * practice and is clamped where it doesn't. */
+void InputRecorder::endFrame(qint64 clock) {
+  if(m_mode != ModeRecord)
+    return;
+
+  m_stream << (quint16)qBound((qint64)0, clock - m_clock, (qint64)0xffff);
+  m_stream << (quint8)m_pending.changes.size();
+
+  foreach(const Change &change, m_pending.changes)
+    m_stream << change.device << change.offset << change.value;
+
+  m_stream << (quint8)m_pending.keys.size();
+
+  foreach(const Key &key, m_pending.keys)
+    m_stream << (quint8)key.down << key.keycode << key.character << key.mod;
+
+  m_clock = clock;
+  m_frames++;
+  m_pending.changes.clear();
+  m_pending.keys.clear();
+}
+
+/* Returns false once the recording is exhausted. */
+bool InputRecorder::nextFrame(Frame &frame) {
+  quint16 delta;
+  quint8 count;
+  quint8 down;
+
+  if(m_mode != ModeReplay || m_stream.atEnd())
+    return false;
+
+  frame.changes.clear();
+  frame.keys.clear();
+
+  m_stream >> delta >> count;
+
+  for(int i = 0; i < count; i++) {
+    Change change;
+
+    m_stream >> change.device >> change.offset >> change.value;
+    frame.changes.append(change);
+  }
+
+  m_stream >> count;
+
+  for(int i = 0; i < count; i++) {
+    Key key;
+
+    m_stream >> down >> key.keycode >> key.character >> key.mod;
+    key.down = down;
+    frame.keys.append(key);
+  }
+
+  if(m_stream.status() != QDataStream::Ok)
+    return false;
+
+  m_clock += delta;
+  m_frames++;
+  frame.clock = m_clock;
+
+  return true;
+}
@@ -0,0 +1,76 @@
+#ifndef INPUTRECORDER_H
+#define INPUTRECORDER_H
+
+#include <QtGlobal>
+#include <QByteArray>
+#include <QDataStream>
+#include <QFile>
+#include <QList>
+#include <QString>
+
+/* Records the input a view receives to a compact binary file, frame by
+ * frame, and plays it back. Only input that changed is stored, so an idle
+ * frame takes four bytes. The header carries what a replay needs to start
+ * from the same place: the session, the wall clock at the start and the
+ * seed for Math.random(). */
+class InputRecorder
+{
+public:
+  enum Mode {
+    ModeOff,
+    ModeRecord,
+    ModeReplay
+  };
+
+  struct Change {
+    quint8 device;
+    quint16 offset;
+    quint16 value;
+  };
+
+  struct Key {
+    bool down;
+    quint16 keycode;
+    quint32 character;
+    quint16 mod;
+  };
+
+  struct Frame {
+    qint64 clock;
+    QList<Change> changes;
+    QList<Key> keys;
+  };
+
+  InputRecorder();
+  ~InputRecorder();
+
+  bool record(const QString &path, const QByteArray &session, qint64 epoch, quint32 seed);
+  bool replay(const QString &path);
+  void stop();
+
+  Mode mode() const;
+  QByteArray session() const;
+  qint64 epoch() const;
+  quint32 seed() const;
+  int frames() const;
+  qint64 clock() const;
+
+  void addChange(quint8 device, quint16 offset, quint16 value);
+  void addKey(bool down, quint16 keycode, quint32 character, quint16 mod);
+  void endFrame(qint64 clock);
+
+  bool nextFrame(Frame &frame);
+
+private:
+  Mode m_mode;
+  QFile m_file;
+  QDataStream m_stream;
+  QByteArray m_session;
+  qint64 m_epoch;
+  quint32 m_seed;
+  qint64 m_clock;
+  int m_frames;
+  Frame m_pending;
+};
+
+#endif // INPUTRECORDER_H
@@ -24,9 +24,22 @@
 
 #include "libretro.h"
 #include "minibrowser.h"
+#include "memorybudget.h"
+#include "framepacer.h"
+#include "inputrecorder.h"
+#include "scalegovernor.h"
+#include "medialoader.h"
+#include "corelog.h"
+#include "allochook.h"
 #include <QApplication>
 #include <QFontDatabase>
 #include <QFile>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QDateTime>
+#include <QList>
+#include <QRunnable>
+#include <QThreadPool>
 
 #ifndef SHARED
 #include <QtPlugin>
@@ -65,6 +78,41 @@ Q_IMPORT_PLUGIN(QOffscreenIntegrationPlugin)
 #define WIDTH 1920
 #define HEIGHT 1080
 
+/* Fixed size reported to the frontend for savestates; the session blob
+ * itself is variable and stored behind a length prefix. */
+#define SESSION_STATE_SIZE (512 * 1024)
+
+/* The last frame of the previous run stays up until the restored page has
+ * loaded, but never longer than this. */
+#define SNAPSHOT_TIMEOUT_MSEC 10000
+/* Maps to zlib level 1, the frame is written on the way out */
+#define SNAPSHOT_PNG_QUALITY 80
+
+/* Turns JavaScriptCore's JIT off; only read when the first VM is created. */
+#define JSC_JIT_ENV "JSC_useJIT"
+
+/* Resident memory is sampled once per this many frames. */
+#define MEMORY_SAMPLE_FRAMES 30
+/* A breakdown is logged this often, and whenever the budget steps in. */
+#define MEMORY_REPORT_MSEC 60000
+
+/* Share of a frame's time render() may take before the automatic render
+ * scale steps down; the rest goes to the event loop and the frontend. */
+#define RENDER_BUDGET_PERCENT 50
+#define RENDER_SCALE_MIN 50
+
+/* One line per page load, in the save directory. */
+#define PAGE_METRICS_FILE "page_loads.csv"
+
+/* Recorded input of the first view, in the save directory. */
+#define INPUT_LOG_FILE "input.mbr"
+
+/* Structured copy of the log, in the save directory. */
+#define LOG_FILE "log.jsonl"
+
+/* Most browser views one process hosts, see minibrowser_views */
+#define MAX_VIEWS 4
+
 /**
  * retro_sleep:
  * @msec         : amount in milliseconds to sleep
@@ -122,9 +170,7 @@ static retro_environment_t NETRETROPAD_CORE_PREFIX(environ_cb);
 static retro_input_poll_t NETRETROPAD_CORE_PREFIX(input_poll_cb);
 static retro_input_state_t NETRETROPAD_CORE_PREFIX(input_state_cb);
 
-static uint8_t *frame_buf;
-
-static struct descriptor joypad = {
+static const struct descriptor joypad_desc = {
    .device = RETRO_DEVICE_JOYPAD,
    .port_min = 0,
    .port_max = 0,
@@ -135,7 +181,7 @@ static struct descriptor joypad = {
    .value = NULL
 };
 
-static struct descriptor analog = {
+static const struct descriptor analog_desc = {
    .device = RETRO_DEVICE_ANALOG,
    .port_min = 0,
    .port_max = 0,
@@ -146,7 +192,7 @@ static struct descriptor analog = {
    .value = NULL
 };
 
-static struct descriptor mouse = {
+static const struct descriptor mouse_desc = {
    .device = RETRO_DEVICE_MOUSE,
    .port_min = 0,
    .port_max = 0,
@@ -157,15 +203,6 @@ static struct descriptor mouse = {
    .value = NULL
 };
 
-static struct descriptor *descriptors[] = {
-   &joypad,
-   &analog,
-   &mouse
-};
-
-static QApplication *browserApp;
-static MiniBrowser *browserWin;
-
 static char browser_name[] = "minibrowser";
 
 #ifdef SHARED
@@ -176,90 +213,596 @@ static char *browser_argv[] = {browser_name, NULL};
 
 static int browser_argc = ARRAY_SIZE(browser_argv) - 1;
 
-static uint16_t x_coord;
-static uint16_t y_coord;
+enum startup_phases {
+   STARTUP_APPLICATION = 0,
+   STARTUP_BROWSER,
+   STARTUP_SETTINGS,
+   STARTUP_NAVIGATE,
+   STARTUP_DONE
+};
+
+static const char *startup_phase_names[] = {
+   "application",
+   "browser",
+   "settings",
+   "navigate",
+};
+
+/* One browser window and the input and output state that goes with it */
+struct browser_view {
+   MiniBrowser *win;
+   uint8_t *frame_buf; /* Shown until the browser has painted its first real frame */
+   bool snapshot_pending; /* frame_buf holds the last frame of the previous run */
+   QByteArray saved_session; /* Read in retro_init, restored in the navigate phase */
+   struct descriptor joypad;
+   struct descriptor analog;
+   struct descriptor mouse;
+   uint16_t x_coord;
+   uint16_t y_coord;
+   ScaleGovernor governor;
+   InputRecorder recorder;
+   InputRecorder::Frame replay_frame;
+   QElapsedTimer input_log_timer;
+   qint64 input_clock; /* What the page's clock reads this frame */
+   qint64 replay_work_usec;
+};
+
+/* Process-wide state. The QApplication, registered fonts, cookies and
+ * WebKit's memory caches are shared by every view. All views keep running;
+ * the active one is shown to the frontend and gets its input, and the
+ * output rate follows it. */
+struct core_context {
+   QApplication *app;
+   QList<QFile*> font_files; /* Keeps embedded fonts mapped for as long as they are registered */
+   QThreadPool font_pool; /* Registers the fallback fonts */
+   unsigned startup_phase;
+   QElapsedTimer startup_timer;
+   bool media_logged;
+   QList<struct browser_view*> views;
+   int active;
+   FramePacer pacer;
+   bool jit; /* Whether JavaScriptCore runs with its JIT */
+   bool jit_next; /* What the environment sets up for the next start */
+   MemoryBudget memory; /* WebKit's caches are process-wide, so is the budget */
+   unsigned memory_frames;
+   QElapsedTimer memory_report_timer;
+   enum retro_log_level memory_report_level;
+};
+
+static struct core_context *core;
+
+struct font_path {
+   const char *path;
+   bool fallback; /* Only needed for glyphs the others lack, registered off the frame thread */
+};
 
 /* Borrowed from RetroArch/gfx/drivers_font_renderer/freetype.c */
-static const char *font_paths[] = {
+static const struct font_path font_paths[] = {
 #if defined(_WIN32)
-   "C:\\Windows\\Fonts\\consola.ttf",
-   "C:\\Windows\\Fonts\\verdana.ttf",
+   { "C:\\Windows\\Fonts\\consola.ttf", false },
+   { "C:\\Windows\\Fonts\\verdana.ttf", false },
 #elif defined(__APPLE__)
-   "/Library/Fonts/Microsoft/Candara.ttf",
-   "/Library/Fonts/Verdana.ttf",
-   "/Library/Fonts/Tahoma.ttf",
+   { "/Library/Fonts/Microsoft/Candara.ttf", false },
+   { "/Library/Fonts/Verdana.ttf", false },
+   { "/Library/Fonts/Tahoma.ttf", false },
 #else
-   "/usr/share/fonts/TTF/DejaVuSansMono.ttf",
-   "/usr/share/fonts/TTF/DejaVuSans.ttf",
-   "/usr/share/fonts/truetype/ttf-dejavu/DejaVuSansMono.ttf",
-   "/usr/share/fonts/truetype/ttf-dejavu/DejaVuSans.ttf",
-   "/usr/share/fonts/truetype/dejavu/DejaVuSansMono.ttf",
-   "/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf",
-   "/usr/share/fonts/TTF/Vera.ttf",
-   "/usr/share/fonts/truetype/droid/DroidSansFallbackFull.ttf",
+   { "/usr/share/fonts/TTF/DejaVuSansMono.ttf", false },
+   { "/usr/share/fonts/TTF/DejaVuSans.ttf", false },
+   { "/usr/share/fonts/truetype/ttf-dejavu/DejaVuSansMono.ttf", false },
+   { "/usr/share/fonts/truetype/ttf-dejavu/DejaVuSans.ttf", false },
+   { "/usr/share/fonts/truetype/dejavu/DejaVuSansMono.ttf", false },
+   { "/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf", false },
+   { "/usr/share/fonts/TTF/Vera.ttf", false },
+   { "/usr/share/fonts/truetype/droid/DroidSansFallbackFull.ttf", true },
 #endif
-   ":/unifont.ttf", /* Embedded in Qt resource file */
-   "osd-font.ttf", /* Magic font to search for, useful for distribution. */
+   { ":/unifont.ttf", true }, /* Embedded in Qt resource file */
+   { "osd-font.ttf", false }, /* Magic font to search for, useful for distribution. */
 };
 
-void NETRETROPAD_CORE_PREFIX(retro_init)(void)
+/**
+ * load_fonts:
+ * @fallback     : load the fallback fonts instead of the primary ones
+ *
+ * Registers fonts without copying them onto the heap. Fonts on disk are
+ * registered by path and read by FreeType on demand; embedded fonts are
+ * stored uncompressed (rcc -no-compress) so they can be mapped in place.
+ **/
+static void load_fonts(bool fallback)
 {
-   struct descriptor *desc;
-   int size;
+   QElapsedTimer timer;
+   int loaded = 0;
    unsigned i;
 
-   frame_buf = NULL;
+   timer.start();
 
-   qputenv("GST_PLUGIN_SYSTEM_PATH", "");
+   for (i = 0; i < ARRAY_SIZE(font_paths); i++)
+   {
+      const char *path = font_paths[i].path;
 
-   browserApp = new QApplication(browser_argc, browser_argv);
+      if (font_paths[i].fallback != fallback || !QFile::exists(path))
+         continue;
 
-   Q_INIT_RESOURCE(res);
+      if (path[0] != ':')
+      {
+         if (QFontDatabase::addApplicationFont(path) >= 0)
+            loaded++;
+         continue;
+      }
 
-   for (i = 0; i < ARRAY_SIZE(font_paths); i++)
-   {
-      const char *path = font_paths[i];
-      QFile fontFile(path);
+      QFile *fontFile = new QFile(path);
+      uchar *data = NULL;
+
+      if (fontFile->open(QIODevice::ReadOnly))
+         data = fontFile->map(0, fontFile->size());
 
-      if (QFile::exists(path) && fontFile.open(QIODevice::ReadOnly))
+      if (data)
+      {
+         if (QFontDatabase::addApplicationFontFromData(
+                  QByteArray::fromRawData((const char*)data, fontFile->size())) >= 0)
+            loaded++;
+         core->font_files.append(fontFile);
+         MemoryBudget::addFontData(data, fontFile->size());
+      }
+      else
       {
-         QByteArray fontData = fontFile.readAll();
-         QFontDatabase::addApplicationFontFromData(fontData);
-         fontFile.close();
+         /* Compressed resource, nothing to map */
+         if (fontFile->isOpen() && QFontDatabase::addApplicationFontFromData(fontFile->readAll()) >= 0)
+            loaded++;
+         delete fontFile;
       }
    }
 
-   browserWin = new MiniBrowser;
-   browserWin->resize(WIDTH, HEIGHT);
-   browserWin->setImage(WIDTH, HEIGHT, QImage::Format_RGB32);
-   browserWin->setCursorEnabled(true);
-   browserWin->show();
-   browserApp->processEvents();
+   CORE_LOG(RETRO_LOG_INFO, "Registered %d %s font(s) in %lld ms.\n",
+         loaded, fallback ? "fallback" : "primary", (long long)timer.elapsed());
+}
+
+/* Registers the fallback fonts on a pool thread, as they are large and
+ * parsing them would hold up the first frames. QFontDatabase locks around
+ * its own state, so a page that looks up a font meanwhile only waits for
+ * the font being registered. */
+class FallbackFonts : public QRunnable
+{
+public:
+   void run()
+   {
+      load_fonts(true);
+   }
+};
+
+enum performance_profiles {
+   PROFILE_FULL,
+   PROFILE_BALANCED,
+   PROFILE_LITE
+};
+
+struct profile_settings {
+   bool auto_load_images;
+   bool images_on_demand;
+   bool javascript;
+   bool jit;
+   bool plugins;
+   bool inspector;
+   bool dns_prefetch;
+   bool icon_database;
+   bool web_fonts;
+};
+
+static const struct profile_settings profiles[] = {
+   /* full */
+   { true, false, true, true, true, true, true, true, true },
+   /* balanced */
+   { true, false, true, true, false, false, true, false, true },
+   /* lite */
+   { true, true, true, false, false, false, false, false, false },
+};
+
+static void netretropad_check_variables(void);
+
+/**
+ * view_create:
+ *
+ * Sets up the input state and placeholder frame of a view. The browser
+ * window itself needs QApplication and is created by view_open().
+ **/
+static struct browser_view *view_create(void)
+{
+   struct browser_view *view = new browser_view;
+   struct descriptor *descs[] = { &view->joypad, &view->analog, &view->mouse };
+   struct descriptor *desc;
+   int size;
+   unsigned i;
+
+   view->win = NULL;
+   view->snapshot_pending = false;
+   view->joypad = joypad_desc;
+   view->analog = analog_desc;
+   view->mouse = mouse_desc;
+   view->x_coord = 0;
+   view->y_coord = 0;
+   view->input_clock = 0;
+   view->replay_work_usec = 0;
+
+   view->frame_buf = (uint8_t*)malloc(WIDTH * HEIGHT * 4);
+
+   if (view->frame_buf)
+      memset(view->frame_buf, 0xff, WIDTH * HEIGHT * 4);
 
    /* Allocate descriptor values */
-   for (i = 0; i < ARRAY_SIZE(descriptors); i++) {
-      desc = descriptors[i];
+   for (i = 0; i < ARRAY_SIZE(descs); i++) {
+      desc = descs[i];
       size = DESC_NUM_PORTS(desc) * DESC_NUM_INDICES(desc) * DESC_NUM_IDS(desc);
-      descriptors[i]->value = (uint16_t*)calloc(size, sizeof(uint16_t));
+      desc->value = (uint16_t*)calloc(size, sizeof(uint16_t));
    }
+
+   return view;
 }
 
-void NETRETROPAD_CORE_PREFIX(retro_deinit)(void)
+static void view_open(struct browser_view *view)
 {
+   view->win = new MiniBrowser;
+   view->win->resize(WIDTH, HEIGHT);
+   view->win->setImage(WIDTH, HEIGHT, QImage::Format_RGB32);
+   view->win->setCursorEnabled(true);
+   view->win->show();
+}
+
+static void view_destroy(struct browser_view *view)
+{
+   struct descriptor *descs[] = { &view->joypad, &view->analog, &view->mouse };
    unsigned i;
 
-   Q_CLEANUP_RESOURCE(res);
+   delete view->win;
 
-   if (frame_buf)
-      free(frame_buf);
-   frame_buf = NULL;
+   if (view->frame_buf)
+      free(view->frame_buf);
 
    /* Free descriptor values */
-   for (i = 0; i < ARRAY_SIZE(descriptors); i++) {
-      if (descriptors[i]->value)
-         free(descriptors[i]->value);
-      descriptors[i]->value = NULL;
+   for (i = 0; i < ARRAY_SIZE(descs); i++)
+      free(descs[i]->value);
+
+   delete view;
+}
+
+static QString state_dir(void)
+{
+   const char *dir = NULL;
+
+   if (!NETRETROPAD_CORE_PREFIX(environ_cb)(RETRO_ENVIRONMENT_GET_SAVE_DIRECTORY, &dir) || !dir)
+      return QString();
+
+   return QString("%1/minibrowser").arg(dir);
+}
+
+static bool restore_enabled(void)
+{
+   struct retro_variable var = {0};
+
+   var.key = "minibrowser_restore_session";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      return strcmp(var.value, "disabled") != 0;
+
+   return true;
+}
+
+static unsigned get_profile(void)
+{
+   struct retro_variable var = {0};
+
+   var.key = "minibrowser_profile";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (!strcmp(var.value, "lite"))
+         return PROFILE_LITE;
+      if (!strcmp(var.value, "balanced"))
+         return PROFILE_BALANCED;
+   }
+
+   return PROFILE_FULL;
+}
+
+/* Individual knobs either follow the profile or override it. */
+static bool get_knob(const char *key, bool profile_value)
+{
+   struct retro_variable var = {0};
+
+   var.key = key;
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (!strcmp(var.value, "enabled"))
+         return true;
+      if (!strcmp(var.value, "disabled"))
+         return false;
    }
+
+   return profile_value;
+}
+
+/* Read once at startup; more views need a restart. */
+static int get_view_count(void)
+{
+   struct retro_variable var = {0};
+
+   var.key = "minibrowser_views";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      return qBound(1, atoi(var.value), MAX_VIEWS);
+
+   return 1;
+}
+
+/**
+ * load_snapshot:
+ *
+ * Puts the last frame of the previous run into frame_buf and reads the
+ * session that goes with it. Only Qt's built-in PNG decoder is needed, so
+ * this works before QApplication exists.
+ **/
+static void load_snapshot(struct browser_view *view)
+{
+   QString dir = state_dir();
+   QImage snapshot;
+   QFile session;
+
+   if (dir.isEmpty() || !view->frame_buf || !restore_enabled())
+      return;
+
+   snapshot.load(dir + "/last_frame.png", "PNG");
+
+   if (snapshot.width() == WIDTH && snapshot.height() == HEIGHT)
+   {
+      snapshot = snapshot.convertToFormat(QImage::Format_RGB32);
+      memcpy(view->frame_buf, snapshot.constBits(), WIDTH * HEIGHT * 4);
+      view->snapshot_pending = true;
+   }
+
+   session.setFileName(dir + "/last_session.bin");
+
+   if (session.open(QIODevice::ReadOnly))
+      view->saved_session = session.readAll();
+}
+
+static void save_snapshot(struct browser_view *view)
+{
+   QString dir = state_dir();
+   QFile session;
+
+   if (dir.isEmpty() || !QDir().mkpath(dir))
+      return;
+
+   /* A page that never loaded would only overwrite a good frame with a blank one */
+   if (!view->snapshot_pending)
+      view->win->image().save(dir + "/last_frame.png", "PNG", SNAPSHOT_PNG_QUALITY);
+
+   session.setFileName(dir + "/last_session.bin");
+
+   if (session.open(QIODevice::WriteOnly | QIODevice::Truncate))
+      session.write(view->win->saveSession());
+}
+
+/**
+ * start_input_log:
+ *
+ * Starts recording the view's input, or replaying an earlier recording, as
+ * the core option asks. A recording starts from the session startup would
+ * have restored. Either way the page is loaded once, from the recorded
+ * session, with its clock and Math.random() already under the core's
+ * control, so a replay shows the same content at the same times as the
+ * recording did. Returns false, having loaded nothing, if neither runs.
+ **/
+static bool start_input_log(struct browser_view *view)
+{
+   struct retro_variable var = {0};
+   QString dir = state_dir();
+   QString path = dir + "/" INPUT_LOG_FILE;
+   qint64 epoch;
+   bool ok;
+
+   var.key = "minibrowser_input_log";
+
+   if (!environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) || !var.value || !strcmp(var.value, "disabled"))
+      return false;
+
+   if (dir.isEmpty() || !QDir().mkpath(dir))
+      return false;
+
+   if (!strcmp(var.value, "replay"))
+      ok = view->recorder.replay(path);
+   else
+   {
+      epoch = QDateTime::currentMSecsSinceEpoch();
+      ok = view->recorder.record(path, view->saved_session, epoch, (quint32)(epoch ^ (epoch >> 32)));
+   }
+
+   if (!ok)
+   {
+      CORE_LOG(RETRO_LOG_WARN, "Could not %s input at %s.\n", var.value, path.toUtf8().constData());
+      return false;
+   }
+
+   view->win->setReplayClock(view->recorder.seed(), view->recorder.epoch());
+
+   if (view->recorder.session().isEmpty() || !view->win->restoreSession(view->recorder.session()))
+      view->win->loadStartPage();
+
+   view->input_clock = 0;
+   view->replay_work_usec = 0;
+   view->input_log_timer.start();
+
+   CORE_LOG(RETRO_LOG_INFO, "%s input %s %s.\n",
+         view->recorder.mode() == InputRecorder::ModeReplay ? "Replaying" : "Recording",
+         view->recorder.mode() == InputRecorder::ModeReplay ? "from" : "to",
+         path.toUtf8().constData());
+
+   return true;
+}
+
+static void stop_input_log(struct browser_view *view)
+{
+   int frames = view->recorder.frames();
+
+   if (view->recorder.mode() == InputRecorder::ModeReplay)
+      CORE_LOG(RETRO_LOG_INFO, "Replayed %d frames (%lld ms recorded) in %lld ms, %.2f ms of work per frame.\n",
+            frames, (long long)view->recorder.clock(), (long long)view->input_log_timer.elapsed(),
+            frames ? view->replay_work_usec / 1000.0 / frames : 0.0);
+   else if (view->recorder.mode() == InputRecorder::ModeRecord)
+      CORE_LOG(RETRO_LOG_INFO, "Recorded %d frames (%lld ms) of input.\n",
+            frames, (long long)view->recorder.clock());
+
+   view->recorder.stop();
+}
+
+/**
+ * startup_step:
+ *
+ * Runs the next phase of core startup. retro_init only prepares a
+ * placeholder frame; everything involving Qt and WebKit is spread over the
+ * first few retro_run calls so the frontend never waits on all of it at
+ * once. Returns true once the browser is fully up.
+ **/
+static bool startup_step(void)
+{
+   struct browser_view *view = core->views.first();
+   const char *system_dir = NULL;
+   QElapsedTimer timer;
+   int i;
+
+   timer.start();
+
+   switch (core->startup_phase)
+   {
+      case STARTUP_APPLICATION:
+         /* The JIT can't be switched once JavaScriptCore is up, so this one
+          * knob only takes effect on the next start */
+         core->jit = get_knob("minibrowser_jit", profiles[get_profile()].jit);
+         core->jit_next = core->jit;
+
+         if (!core->jit)
+            qputenv(JSC_JIT_ENV, "false");
+
+         core->app = new QApplication(browser_argc, browser_argv);
+
+         Q_INIT_RESOURCE(res);
+
+         load_fonts(false);
+         core->font_pool.start(new FallbackFonts);
+
+         /* Decoders are only registered once a page asks for media */
+         MediaLoader::initialize();
+         break;
+      case STARTUP_BROWSER:
+         for (i = 0; i < core->views.size(); i++)
+            view_open(core->views[i]);
+
+         /* Keyboard and mouse events go to the active window's focus */
+         view->win->activateWindow();
+         core->app->processEvents();
+         break;
+      case STARTUP_SETTINGS:
+         netretropad_check_variables();
+
+         if (environ_cb(RETRO_ENVIRONMENT_GET_SYSTEM_DIRECTORY, &system_dir) && system_dir)
+         {
+            QString filters = QString("%1/minibrowser/filters").arg(system_dir);
+            int rules = view->win->loadContentFilters(filters);
+
+            if (rules > 0)
+               CORE_LOG(RETRO_LOG_INFO, "Loaded %d content filter rules from %s.\n",
+                     rules, filters.toUtf8().constData());
+         }
+
+         /* Later views use the first one's cookies and content filters */
+         for (i = 1; i < core->views.size(); i++)
+            core->views[i]->win->shareNetwork(view->win);
+         break;
+      case STARTUP_NAVIGATE:
+         for (i = 0; i < core->views.size(); i++)
+         {
+            struct browser_view *v = core->views[i];
+
+            /* Input is only logged in the first view, which then loads
+             * its page from the log's session instead */
+            if ((i > 0 || !start_input_log(v))
+                  && (v->saved_session.isEmpty() || !v->win->restoreSession(v->saved_session)))
+               v->win->loadStartPage();
+
+            v->saved_session.clear();
+         }
+         core->app->processEvents();
+         break;
+      default:
+         return true;
+   }
+
+   CORE_LOG(RETRO_LOG_INFO, "Startup phase '%s' took %lld ms (%lld ms since init).\n",
+         startup_phase_names[core->startup_phase], (long long)timer.elapsed(),
+         (long long)core->startup_timer.elapsed());
+
+   core->startup_phase++;
+
+   return core->startup_phase == STARTUP_DONE;
+}
+
+void NETRETROPAD_CORE_PREFIX(retro_init)(void)
+{
+   int count = get_view_count();
+   int i;
+
+   core = new core_context;
+   core->app = NULL;
+   core->media_logged = false;
+   core->jit = true;
+   core->jit_next = true;
+   core->memory_frames = 0;
+   core->memory_report_level = RETRO_LOG_INFO;
+   core->startup_timer.start();
+   core->startup_phase = STARTUP_APPLICATION;
+   core->active = 0;
+
+   qputenv("GST_PLUGIN_SYSTEM_PATH", "");
+
+   /* The frontend is only ever called from the log thread from here on */
+   CoreLog::start(log_cb);
+
+   for (i = 0; i < count; i++)
+      core->views.append(view_create());
+
+   load_snapshot(core->views.first());
+
+   if (count > 1)
+      CORE_LOG(RETRO_LOG_INFO, "Hosting %d browser views, Alt+F1 to Alt+F%d switch between them.\n", count, count);
+}
+
+void NETRETROPAD_CORE_PREFIX(retro_deinit)(void)
+{
+   int i;
+
+   if (!core)
+      return;
+
+   if (core->startup_phase == STARTUP_DONE)
+      save_snapshot(core->views.first());
+
+   for (i = 0; i < core->views.size(); i++)
+      stop_input_log(core->views[i]);
+
+   while (!core->views.isEmpty())
+      view_destroy(core->views.takeLast());
+
+   core->font_pool.waitForDone();
+   QFontDatabase::removeAllApplicationFonts();
+   qDeleteAll(core->font_files);
+   core->font_files.clear();
+
+   Q_CLEANUP_RESOURCE(res);
+
+   CoreLog::stop();
+
+   /* The QApplication is deliberately kept, as it always was */
+   delete core;
+   core = NULL;
 }
 
 unsigned NETRETROPAD_CORE_PREFIX(retro_api_version)(void)
@@ -287,7 +830,7 @@ void NETRETROPAD_CORE_PREFIX(retro_get_system_info)(
 void NETRETROPAD_CORE_PREFIX(retro_get_system_av_info)(
       struct retro_system_av_info *info)
 {
-   info->timing.fps = 60.0;
+   info->timing.fps = core ? core->pacer.rate() : 60.0;
    info->timing.sample_rate = 30000.0;
 
    info->geometry.base_width  = WIDTH;
@@ -300,6 +843,28 @@ void NETRETROPAD_CORE_PREFIX(retro_get_system_av_info)(
 void NETRETROPAD_CORE_PREFIX(retro_set_environment)(retro_environment_t cb)
 {
    static const struct retro_variable vars[] = {
+      { "minibrowser_downscale_images", "Downscale oversized images; disabled|enabled" },
+      { "minibrowser_memory_budget", "Memory budget (MB); unlimited|128|192|256|384|512|768|1024" },
+      { "minibrowser_restore_session", "Restore last session on startup; enabled|disabled" },
+      { "minibrowser_adaptive_fps", "Adapt frame rate to content; enabled|disabled" },
+      { "minibrowser_page_metrics", "Log page load times to the save directory; disabled|enabled" },
+      { "minibrowser_render_scale", "Internal render scale (%); 100|auto|90|80|70|60|50" },
+      { "minibrowser_profile", "Performance profile; full|balanced|lite" },
+      { "minibrowser_auto_load_images", "Load images; profile|enabled|disabled" },
+      { "minibrowser_images_on_demand", "Only load images near the viewport; profile|enabled|disabled" },
+      { "minibrowser_javascript", "JavaScript; profile|enabled|disabled" },
+      { "minibrowser_jit", "JavaScript JIT (restart); profile|enabled|disabled" },
+      { "minibrowser_plugins", "Plugins; profile|enabled|disabled" },
+      { "minibrowser_inspector", "Web inspector; profile|enabled|disabled" },
+      { "minibrowser_dns_prefetch", "DNS prefetching; profile|enabled|disabled" },
+      { "minibrowser_icon_database", "Favicon database; profile|enabled|disabled" },
+      { "minibrowser_web_fonts", "Web fonts; profile|enabled|disabled" },
+      { "minibrowser_input_log", "Input recording (restart); disabled|record|replay" },
+      { "minibrowser_views", "Browser views (restart); 1|2|3|4" },
+      { "minibrowser_script_watchdog", "Stop scripts that run for 10 s without yielding; enabled|disabled" },
+      { "minibrowser_script_block", "Turn off JavaScript on sites with stopped scripts; disabled|enabled" },
+      { "minibrowser_log_level", "Log level; info|debug|warn|error" },
+      { "minibrowser_log_file", "Write the log to the save directory; disabled|enabled" },
       { NULL, NULL },
    };
    enum retro_pixel_format fmt = RETRO_PIXEL_FORMAT_XRGB8888;
@@ -316,8 +881,140 @@ void NETRETROPAD_CORE_PREFIX(retro_set_environment)(retro_environment_t cb)
       NETRETROPAD_CORE_PREFIX(log_cb) = logger.log;
 }
 
+static void view_check_variables(struct browser_view *view)
+{
+   struct retro_variable var = {0};
+   const struct profile_settings *profile = &profiles[get_profile()];
+   MiniBrowser *browserWin = view->win;
+
+   browserWin->setWebAttribute(QWebSettings::AutoLoadImages, get_knob("minibrowser_auto_load_images", profile->auto_load_images));
+   browserWin->setImagesOnDemand(get_knob("minibrowser_images_on_demand", profile->images_on_demand));
+   browserWin->setWebAttribute(QWebSettings::JavascriptEnabled, get_knob("minibrowser_javascript", profile->javascript));
+   browserWin->setWebAttribute(QWebSettings::PluginsEnabled, get_knob("minibrowser_plugins", profile->plugins));
+   browserWin->setWebAttribute(QWebSettings::DeveloperExtrasEnabled, get_knob("minibrowser_inspector", profile->inspector));
+   browserWin->setWebAttribute(QWebSettings::DnsPrefetchEnabled, get_knob("minibrowser_dns_prefetch", profile->dns_prefetch));
+   browserWin->setWebFontsEnabled(get_knob("minibrowser_web_fonts", profile->web_fonts));
+
+   if (get_knob("minibrowser_icon_database", profile->icon_database) && !state_dir().isEmpty())
+      browserWin->setIconDatabasePath(state_dir() + "/icons");
+   else
+      browserWin->setIconDatabasePath(QString());
+
+   var.key = "minibrowser_downscale_images";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      browserWin->setMaxImageSize(!strcmp(var.value, "enabled") ? QSize(WIDTH, HEIGHT) : QSize());
+
+   var.key = "minibrowser_page_metrics";
+   var.value = NULL;
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (!strcmp(var.value, "enabled") && !state_dir().isEmpty() && QDir().mkpath(state_dir()))
+         browserWin->setMetricsPath(state_dir() + "/" PAGE_METRICS_FILE);
+      else
+         browserWin->setMetricsPath(QString());
+   }
+
+   var.key = "minibrowser_script_watchdog";
+   var.value = NULL;
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      struct retro_variable block = {0};
+
+      block.key = "minibrowser_script_block";
+
+      browserWin->setScriptWatchdog(!strcmp(var.value, "enabled"),
+            environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &block) && block.value && !strcmp(block.value, "enabled"));
+   }
+
+   var.key = "minibrowser_render_scale";
+   var.value = NULL;
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (!strcmp(var.value, "auto"))
+         view->governor.setRange(RENDER_SCALE_MIN, 100);
+      else
+         view->governor.setRange(atoi(var.value), atoi(var.value));
+
+      browserWin->setRenderScale(view->governor.scale());
+   }
+}
+
+static void log_check_variables(void)
+{
+   struct retro_variable var = {0};
+
+   var.key = "minibrowser_log_level";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (!strcmp(var.value, "debug"))
+         CoreLog::setLevel(RETRO_LOG_DEBUG);
+      else if (!strcmp(var.value, "warn"))
+         CoreLog::setLevel(RETRO_LOG_WARN);
+      else if (!strcmp(var.value, "error"))
+         CoreLog::setLevel(RETRO_LOG_ERROR);
+      else
+         CoreLog::setLevel(RETRO_LOG_INFO);
+   }
+
+   var.key = "minibrowser_log_file";
+   var.value = NULL;
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+   {
+      if (!strcmp(var.value, "enabled") && !state_dir().isEmpty() && QDir().mkpath(state_dir()))
+         CoreLog::setFile(state_dir() + "/" LOG_FILE);
+      else
+         CoreLog::setFile(QString());
+   }
+}
+
 static void netretropad_check_variables(void)
 {
+   struct retro_variable var = {0};
+   bool jit;
+   int i;
+
+   log_check_variables();
+
+   /* Applied once the browser exists, see startup_step() */
+   if (!core || core->startup_phase <= STARTUP_BROWSER)
+      return;
+
+   for (i = 0; i < core->views.size(); i++)
+      view_check_variables(core->views[i]);
+
+   jit = get_knob("minibrowser_jit", profiles[get_profile()].jit);
+
+   /* Only a new JavaScriptCore reads the environment, so it is kept in
+    * step with the setting for the next start */
+   if (jit != core->jit_next)
+   {
+      core->jit_next = jit;
+
+      if (jit)
+         qunsetenv(JSC_JIT_ENV);
+      else
+         qputenv(JSC_JIT_ENV, "false");
+
+      CORE_LOG(RETRO_LOG_INFO, "The JavaScript JIT %s after a restart.\n",
+            jit == core->jit ? "stays as it is" : (jit ? "turns on" : "turns off"));
+   }
+
+   var.key = "minibrowser_adaptive_fps";
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      core->pacer.setEnabled(!strcmp(var.value, "enabled"));
+
+   var.key = "minibrowser_memory_budget";
+   var.value = NULL;
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE, &var) && var.value)
+      core->memory.setBudget(!strcmp(var.value, "unlimited") ? 0 : (qint64)atoi(var.value) * 1024 * 1024);
 }
 
 void NETRETROPAD_CORE_PREFIX(retro_set_audio_sample)(retro_audio_sample_t cb)
@@ -348,12 +1045,66 @@ void NETRETROPAD_CORE_PREFIX(retro_set_video_refresh)(retro_video_refresh_t cb)
 
 void NETRETROPAD_CORE_PREFIX(retro_reset)(void)
 {
-   x_coord = 0;
-   y_coord = 0;
+   int i;
+
+   if (!core)
+      return;
+
+   for (i = 0; i < core->views.size(); i++)
+   {
+      core->views[i]->x_coord = 0;
+      core->views[i]->y_coord = 0;
+   }
 }
 
-static void retropad_update_input(void)
+/**
+ * replay_input:
+ *
+ * Sets the view's input to the next recorded frame instead of what the
+ * frontend reports, and moves the page clock to that frame's time. The
+ * recorded keys are sent by view_run().
+ **/
+static void replay_input(struct browser_view *view)
 {
+   struct descriptor *descs[] = { &view->joypad, &view->analog, &view->mouse };
+   struct descriptor *desc;
+   int size;
+   int i;
+
+   if (!view->recorder.nextFrame(view->replay_frame))
+   {
+      stop_input_log(view);
+
+      /* Nothing stays held once the recording is over */
+      for (i = 0; i < (int)ARRAY_SIZE(descs); i++)
+      {
+         desc = descs[i];
+         memset(desc->value, 0, DESC_NUM_PORTS(desc) * DESC_NUM_INDICES(desc) * DESC_NUM_IDS(desc) * sizeof(uint16_t));
+      }
+      return;
+   }
+
+   for (i = 0; i < view->replay_frame.changes.size(); i++)
+   {
+      const InputRecorder::Change &change = view->replay_frame.changes[i];
+
+      if (change.device >= ARRAY_SIZE(descs))
+         continue;
+
+      desc = descs[change.device];
+      size = DESC_NUM_PORTS(desc) * DESC_NUM_INDICES(desc) * DESC_NUM_IDS(desc);
+
+      if (change.offset < size)
+         desc->value[change.offset] = change.value;
+   }
+
+   view->input_clock = view->replay_frame.clock;
+   view->win->setClock(view->input_clock);
+}
+
+static void retropad_update_input(struct browser_view *view)
+{
+   struct descriptor *descs[] = { &view->joypad, &view->analog, &view->mouse };
    struct descriptor *desc;
    /*struct remote_joypad_message msg;*/
    uint16_t state;
@@ -367,11 +1118,17 @@ static void retropad_update_input(void)
    /* Poll input */
    NETRETROPAD_CORE_PREFIX(input_poll_cb)();
 
+   if (view->recorder.mode() == InputRecorder::ModeReplay)
+   {
+      replay_input(view);
+      return;
+   }
+
    /* Parse descriptors */
-   for (i = 0; i < ARRAY_SIZE(descriptors); i++)
+   for (i = 0; i < ARRAY_SIZE(descs); i++)
    {
       /* Get current descriptor */
-      desc = descriptors[i];
+      desc = descs[i];
 
       /* Go through range of ports/indices/IDs */
       for (port = desc->port_min; port <= desc->port_max; port++)
@@ -399,6 +1156,7 @@ static void retropad_update_input(void)
 
                /* Update state */
                desc->value[offset] = state;
+               view->recorder.addChange(i, offset, state);
 
                /* Attempt to send updated state */
                /*msg.port = port;
@@ -625,7 +1383,63 @@ static inline QtKey retrokey_to_qt(unsigned button, uint32_t character, uint16_t
    return QtKey(static_cast<Qt::Key>(0));
 }
 
-void NETRETROPAD_CORE_PREFIX(retro_run)(void)
+#define MB(bytes) ((bytes) / (1024.0 * 1024.0))
+
+/**
+ * memory_report:
+ *
+ * Starts working out where the process memory goes, adding up what every
+ * view holds. The mappings are read off the frame thread and
+ * sample_memory() logs the result once it is in.
+ **/
+static void memory_report(enum retro_log_level level)
+{
+   qint64 frame_buffers = 0;
+   qint64 tab_states = 0;
+   qint64 network = 0;
+   int i;
+
+   for (i = 0; i < core->views.size(); i++)
+   {
+      core->views[i]->win->addMemoryHeld(frame_buffers, tab_states, network);
+
+      if (core->views[i]->frame_buf)
+         frame_buffers += WIDTH * HEIGHT * 4;
+   }
+
+   core->memory_report_timer.start();
+   core->memory_report_level = level;
+   core->memory.startAccount(frame_buffers, tab_states, network);
+}
+
+/**
+ * memory_report_log:
+ *
+ * Logs a finished memory report, each figure followed by its high-water
+ * mark, in MB.
+ **/
+static void memory_report_log(const MemoryUsage &now)
+{
+   const MemoryUsage &peak = core->memory.peak();
+
+   CORE_LOG(core->memory_report_level, "Memory (MB, peak): resident %.1f (%.1f), frame buffers %.1f (%.1f), "
+         "tab states %.1f (%.1f), network buffers %.1f (%.1f), object cache limit %.1f (%.1f), "
+         "fonts %.1f (%.1f), code %.1f (%.1f), other files %.1f (%.1f), "
+         "heap incl. JS and DOM %.1f (%.1f).\n",
+         MB(now.resident), MB(peak.resident), MB(now.frameBuffers), MB(peak.frameBuffers),
+         MB(now.tabStates), MB(peak.tabStates), MB(now.network), MB(peak.network),
+         MB(now.objectCache), MB(peak.objectCache), MB(now.fonts), MB(peak.fonts),
+         MB(now.code), MB(peak.code), MB(now.files), MB(peak.files),
+         MB(now.anonymous), MB(peak.anonymous));
+}
+
+/**
+ * view_run:
+ *
+ * Feeds one frame of input to a view and renders it. Returns the frame to
+ * present.
+ **/
+static const void *view_run(struct browser_view *view)
 {
    int offset;
    int i;
@@ -633,42 +1447,298 @@ void NETRETROPAD_CORE_PREFIX(retro_run)(void)
    bool mouse_right;
    uint16_t new_x_coord;
    uint16_t new_y_coord;
+   qint64 budget;
+   QElapsedTimer render_timer;
+   MiniBrowser *browserWin = view->win;
+
+   /* Swap the snapshot for the real page once it has something to show */
+   if (view->snapshot_pending && (browserWin->pageLoaded() || core->startup_timer.elapsed() > SNAPSHOT_TIMEOUT_MSEC))
+   {
+      view->snapshot_pending = false;
+      free(view->frame_buf);
+      view->frame_buf = NULL;
+   }
+
+   if (view->recorder.mode() == InputRecorder::ModeRecord)
+   {
+      view->input_clock = view->input_log_timer.elapsed();
+      browserWin->setClock(view->input_clock);
+   }
 
    /* Update input states and send them if needed */
-   retropad_update_input();
+   retropad_update_input(view);
 
-   mouse_left = mouse.value[DESC_OFFSET(&mouse, 0, 0, RETRO_DEVICE_ID_MOUSE_LEFT)];
-   mouse_right = mouse.value[DESC_OFFSET(&mouse, 0, 0, RETRO_DEVICE_ID_MOUSE_RIGHT)];
+   if (view->recorder.mode() == InputRecorder::ModeReplay)
+   {
+      for (i = 0; i < view->replay_frame.keys.size(); i++)
+      {
+         const InputRecorder::Key &key = view->replay_frame.keys[i];
 
-   new_x_coord = x_coord + mouse.value[DESC_OFFSET(&mouse, 0, 0, RETRO_DEVICE_ID_MOUSE_X)];
-   new_y_coord = y_coord + mouse.value[DESC_OFFSET(&mouse, 0, 0, RETRO_DEVICE_ID_MOUSE_Y)];
+         browserWin->onRetroKeyInput(retrokey_to_qt(key.keycode, key.character, key.mod), key.down);
+      }
+   }
+
+   mouse_left = view->mouse.value[DESC_OFFSET(&view->mouse, 0, 0, RETRO_DEVICE_ID_MOUSE_LEFT)];
+   mouse_right = view->mouse.value[DESC_OFFSET(&view->mouse, 0, 0, RETRO_DEVICE_ID_MOUSE_RIGHT)];
 
-   browserWin->onMouseInput(QtMouse(QPoint(x_coord, y_coord), QPoint(new_x_coord, new_y_coord), mouse_left, mouse_right));
+   new_x_coord = view->x_coord + view->mouse.value[DESC_OFFSET(&view->mouse, 0, 0, RETRO_DEVICE_ID_MOUSE_X)];
+   new_y_coord = view->y_coord + view->mouse.value[DESC_OFFSET(&view->mouse, 0, 0, RETRO_DEVICE_ID_MOUSE_Y)];
 
-   x_coord = new_x_coord;
-   y_coord = new_y_coord;
+   browserWin->onMouseInput(QtMouse(QPoint(view->x_coord, view->y_coord), QPoint(new_x_coord, new_y_coord), mouse_left, mouse_right));
 
-   for (i = joypad.id_min; i <= joypad.id_max; i++)
+   view->x_coord = new_x_coord;
+   view->y_coord = new_y_coord;
+
+   for (i = view->joypad.id_min; i <= view->joypad.id_max; i++)
    {
-      offset = DESC_OFFSET(&joypad, 0, 0, i);
+      offset = DESC_OFFSET(&view->joypad, 0, 0, i);
 
-      if (joypad.value[offset])
+      if (view->joypad.value[offset])
          browserWin->onRetroPadInput(offset);
    }
 
+   render_timer.start();
    browserWin->render();
-   browserApp->processEvents();
 
-   NETRETROPAD_CORE_PREFIX(video_cb)(browserWin->getImage(), WIDTH, HEIGHT, WIDTH * 4);
+   budget = (qint64)(1000000.0 / core->pacer.rate()) * RENDER_BUDGET_PERCENT / 100;
+
+   if (view->governor.sample(render_timer.nsecsElapsed() / 1000, budget))
+   {
+      browserWin->setRenderScale(view->governor.scale());
+
+      CORE_LOG(RETRO_LOG_INFO, "Render scale changed to %d%%.\n", view->governor.scale());
+   }
+
+   return view->snapshot_pending ? (const void*)view->frame_buf : (const void*)browserWin->getImage();
+}
+
+/**
+ * discard_tab:
+ *
+ * Discards the least recently used background tab of all views.
+ **/
+static bool discard_tab(void)
+{
+   MiniBrowser *owner = NULL;
+   qint64 oldest = -1;
+   int i;
+
+   for (i = 0; i < core->views.size(); i++)
+   {
+      qint64 used = core->views[i]->win->oldestBackgroundTab();
+
+      if (used >= 0 && (!owner || used < oldest))
+      {
+         owner = core->views[i]->win;
+         oldest = used;
+      }
+   }
+
+   return owner && owner->discardTab();
+}
+
+/**
+ * sample_memory:
+ *
+ * Checks the process against the memory budget every few frames. Whatever
+ * step the budget picks is taken once for all views: one tab is discarded
+ * from whichever view has the least recently used one, and only the shown
+ * view is reloaded. Logs where the memory goes now and then, or whenever
+ * the budget had to act.
+ **/
+static void sample_memory(void)
+{
+   MemoryBudget::Action action;
+   MemoryUsage usage;
+   int discardable = 0;
+   int i;
+
+   if (++core->memory_frames % MEMORY_SAMPLE_FRAMES != 0)
+      return;
+
+   if (core->memory.takeAccount(usage))
+      memory_report_log(usage);
+
+   for (i = 0; i < core->views.size(); i++)
+      discardable += core->views[i]->win->liveBackgroundTabs();
+
+   core->memory.setDiscardableTabs(discardable);
+   action = core->memory.sample();
+
+   if (action == MemoryBudget::ActionDiscardTab)
+      discard_tab();
+   else if (action == MemoryBudget::ActionReload)
+      core->views[core->active]->win->reloadPage();
+
+   if (action != MemoryBudget::ActionNone)
+   {
+      CORE_LOG(RETRO_LOG_WARN, "Resident memory at %lld MB, %s.\n",
+            (long long)(core->memory.lastResident() / (1024 * 1024)),
+            MemoryBudget::actionName(action));
+
+      memory_report(RETRO_LOG_WARN);
+   }
+   else if (!core->memory_report_timer.isValid() || core->memory_report_timer.elapsed() >= MEMORY_REPORT_MSEC)
+      memory_report(RETRO_LOG_INFO);
+}
+
+/**
+ * views_entered:
+ *
+ * Restarts the script watchdog's clock in every open view. Page scripts
+ * run whenever the core hands control to Qt, not only while a frame runs.
+ **/
+static void views_entered(void)
+{
+   int i;
+
+   for (i = 0; i < core->views.size(); i++)
+   {
+      if (core->views[i]->win)
+         core->views[i]->win->frameStarted();
+   }
+}
+
+/**
+ * switch_view:
+ * @index        : view to show
+ *
+ * Shows another view and sends it the input from now on. The cursor stays
+ * where that view last had it.
+ **/
+static void switch_view(int index)
+{
+   if (index < 0 || index >= core->views.size() || index == core->active)
+      return;
+
+   core->active = index;
+   core->views[index]->win->activateWindow();
+
+   CORE_LOG(RETRO_LOG_INFO, "Showing browser view %d of %d.\n", index + 1, core->views.size());
+}
+
+void NETRETROPAD_CORE_PREFIX(retro_run)(void)
+{
+   struct browser_view *view = core->views.first();
+   const void *frame;
+   bool updated = false;
+   QElapsedTimer work;
+   int i;
+
+   views_entered();
+
+   if (core->startup_phase != STARTUP_DONE)
+   {
+      if (view->frame_buf)
+         NETRETROPAD_CORE_PREFIX(video_cb)(view->frame_buf, WIDTH, HEIGHT, WIDTH * 4);
+
+      NETRETROPAD_CORE_PREFIX(input_poll_cb)();
+
+      if (startup_step())
+      {
+         for (i = 0; i < core->views.size(); i++)
+         {
+            struct browser_view *v = core->views[i];
+
+            if (v->frame_buf && !v->snapshot_pending)
+            {
+               free(v->frame_buf);
+               v->frame_buf = NULL;
+            }
+         }
+      }
+      return;
+   }
+
+   if (environ_cb(RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE, &updated) && updated)
+      netretropad_check_variables();
+
+   /* Only the active view gets input and is rendered; the others keep
+    * loading and running their pages and catch up on being shown */
+   view = core->views[core->active];
+
+   work.start();
+   frame = view_run(view);
+
+   /* Only the core's own handlers count towards allocations in here */
+   {
+      ALLOC_EXEMPT();
+      core->app->processEvents();
+   }
+
+   if (view->recorder.mode() == InputRecorder::ModeReplay)
+      view->replay_work_usec += work.nsecsElapsed() / 1000;
+
+   view->recorder.endFrame(view->input_clock);
+
+   if (!core->media_logged && MediaLoader::loaded())
+   {
+      core->media_logged = true;
+
+      CORE_LOG(RETRO_LOG_INFO, "Registered media decoders on first use in %lld ms.\n",
+            (long long)MediaLoader::loadMsec());
+   }
+
+   sample_memory();
+
+   /* Repaints of views that aren't shown say nothing about the output rate */
+   for (i = 0; i < core->views.size(); i++)
+   {
+      if (i != core->active)
+         core->views[i]->win->takeUpdates();
+   }
+
+   NETRETROPAD_CORE_PREFIX(video_cb)(frame, WIDTH, HEIGHT, WIDTH * 4);
+
+   if (core->pacer.sample(view->win->takeUpdates(), view->win->videoPlaying()))
+   {
+      struct retro_system_av_info info;
+
+      NETRETROPAD_CORE_PREFIX(retro_get_system_av_info)(&info);
+      info.timing.fps = core->pacer.proposed();
+
+      /* The rate only changes once the frontend runs at it */
+      if (environ_cb(RETRO_ENVIRONMENT_SET_SYSTEM_AV_INFO, &info))
+      {
+         core->pacer.accept();
+         CORE_LOG(RETRO_LOG_INFO, "Output rate changed to %.0f fps.\n", info.timing.fps);
+      }
+      else
+      {
+         core->pacer.refuse();
+         CORE_LOG(RETRO_LOG_WARN, "Frontend refused %.0f fps, staying at %.0f fps without adapting.\n",
+               info.timing.fps, core->pacer.rate());
+      }
+   }
 }
 
 static void keyboard_cb(bool down, unsigned keycode,
       uint32_t character, uint16_t mod)
 {
-   log_cb(RETRO_LOG_INFO, "Down: %s, Code: %d, Char: %u, Mod: %u.\n",
+   struct browser_view *view;
+
+   CORE_LOG(RETRO_LOG_DEBUG, "Down: %s, Code: %d, Char: %u, Mod: %u.\n",
          down ? "yes" : "no", keycode, character, mod);
 
-   browserWin->onRetroKeyInput(retrokey_to_qt(keycode, character, mod), down);
+   if (!core || core->startup_phase != STARTUP_DONE)
+      return;
+
+   /* Alt+F1 to Alt+F4 pick the view that is shown */
+   if ((mod & RETROKMOD_ALT) && keycode >= RETROK_F1 && keycode < RETROK_F1 + MAX_VIEWS)
+   {
+      if (down)
+         switch_view(keycode - RETROK_F1);
+      return;
+   }
+
+   view = core->views[core->active];
+
+   /* The recording drives the page */
+   if (view->recorder.mode() == InputRecorder::ModeReplay)
+      return;
+
+   view->recorder.addKey(down, keycode, character, mod);
+   view->win->onRetroKeyInput(retrokey_to_qt(keycode, character, mod), down);
 }
 
 bool NETRETROPAD_CORE_PREFIX(retro_load_game)(const struct retro_game_info *)
@@ -700,22 +1770,50 @@ bool NETRETROPAD_CORE_PREFIX(retro_load_game_special)(unsigned type,
 
 size_t NETRETROPAD_CORE_PREFIX(retro_serialize_size)(void)
 {
-   return 0;
+   return SESSION_STATE_SIZE;
 }
 
 bool NETRETROPAD_CORE_PREFIX(retro_serialize)(void *data, size_t size)
 {
-   (void)data;
-   (void)size;
-   return false;
+   QByteArray session;
+   uint32_t len;
+
+   if (!core || core->startup_phase != STARTUP_DONE || size < sizeof(len))
+      return false;
+
+   views_entered();
+   session = core->views[core->active]->win->saveSession();
+   len = session.size();
+
+   if (len > size - sizeof(len))
+   {
+      CORE_LOG(RETRO_LOG_WARN, "Session of %u bytes does not fit in a savestate.\n", len);
+      return false;
+   }
+
+   memcpy(data, &len, sizeof(len));
+   memcpy((uint8_t*)data + sizeof(len), session.constData(), len);
+   memset((uint8_t*)data + sizeof(len) + len, 0, size - sizeof(len) - len);
+
+   return true;
 }
 
 bool NETRETROPAD_CORE_PREFIX(retro_unserialize)(const void *data,
       size_t size)
 {
-   (void)data;
-   (void)size;
-   return false;
+   uint32_t len;
+
+   if (!core || core->startup_phase != STARTUP_DONE || size < sizeof(len))
+      return false;
+
+   memcpy(&len, data, sizeof(len));
+
+   if (len == 0 || len > size - sizeof(len))
+      return false;
+
+   views_entered();
+
+   return core->views[core->active]->win->restoreSession(QByteArray((const char*)data + sizeof(len), len));
 }
 
 void *NETRETROPAD_CORE_PREFIX(retro_get_memory_data)(unsigned id)
@@ -7,6 +7,7 @@ int main(int argc, char *argv[])
    //QFontDatabase::addApplicationFont("rarch.ttf");
    MiniBrowser w;
    w.show();
+   w.loadStartPage();
 
    return a.exec();
 }
@@ -0,0 +1,96 @@
+#include "medialoader.h"
+#include <QElapsedTimer>
+#include <gst/gst.h>
+
+#ifdef STATIC_MEDIA
+/* Enough for WebKit's media engine to report itself available, answer
+ * canPlayType() and put together playbin with its audio and video sinks. */
+GST_PLUGIN_STATIC_DECLARE(coreelements);
+GST_PLUGIN_STATIC_DECLARE(typefindfunctions);
+GST_PLUGIN_STATIC_DECLARE(playback);
+GST_PLUGIN_STATIC_DECLARE(app);
+GST_PLUGIN_STATIC_DECLARE(autodetect);
+GST_PLUGIN_STATIC_DECLARE(pulseaudio);
+GST_PLUGIN_STATIC_DECLARE(audiofx);
+GST_PLUGIN_STATIC_DECLARE(audioconvert);
+GST_PLUGIN_STATIC_DECLARE(audioresample);
+GST_PLUGIN_STATIC_DECLARE(volume);
+GST_PLUGIN_STATIC_DECLARE(videoconvert);
+GST_PLUGIN_STATIC_DECLARE(videoscale);
+
+/* Only autoplugged once data arrives. libav alone registers an element for
+ * every codec FFmpeg was built with. */
+GST_PLUGIN_STATIC_DECLARE(libav);
+GST_PLUGIN_STATIC_DECLARE(isomp4);
+GST_PLUGIN_STATIC_DECLARE(videoparsersbad);
+GST_PLUGIN_STATIC_DECLARE(audioparsers);
+GST_PLUGIN_STATIC_DECLARE(deinterlace);
+GST_PLUGIN_STATIC_DECLARE(videofilter);
+GST_PLUGIN_STATIC_DECLARE(debugutilsbad);
+#endif
+
+bool MediaLoader::s_initialized = false;
+bool MediaLoader::s_loaded = false;
+qint64 MediaLoader::s_loadMsec = -1;
+
+/* Must run before the first page load: WebKit decides once, the first time
+ * it looks up a MIME type, whether media is supported at all. */
+void MediaLoader::initialize() {
+  if(s_initialized)
+    return;
+
+  s_initialized = true;
+
+  if(!gst_init_check(NULL, NULL, NULL))
+    return;
+
+#ifdef STATIC_MEDIA
+  GST_PLUGIN_STATIC_REGISTER(coreelements);
+  GST_PLUGIN_STATIC_REGISTER(typefindfunctions);
+  GST_PLUGIN_STATIC_REGISTER(playback);
+  GST_PLUGIN_STATIC_REGISTER(app);
+  GST_PLUGIN_STATIC_REGISTER(autodetect);
+  GST_PLUGIN_STATIC_REGISTER(pulseaudio);
+  GST_PLUGIN_STATIC_REGISTER(audiofx);
+  GST_PLUGIN_STATIC_REGISTER(audioconvert);
+  GST_PLUGIN_STATIC_REGISTER(audioresample);
+  GST_PLUGIN_STATIC_REGISTER(volume);
+  GST_PLUGIN_STATIC_REGISTER(videoconvert);
+  GST_PLUGIN_STATIC_REGISTER(videoscale);
+#endif
+}
+
+/* Returns true if this call did the work. Pipelines look decoders up only
+ * when their first data is typefound, so registering them as the first
+ * media request goes out is in time. */
+bool MediaLoader::load() {
+  QElapsedTimer timer;
+
+  if(s_loaded || !s_initialized)
+    return false;
+
+  timer.start();
+  s_loaded = true;
+
+#ifdef STATIC_MEDIA
+  GST_PLUGIN_STATIC_REGISTER(libav);
+  GST_PLUGIN_STATIC_REGISTER(isomp4);
+  GST_PLUGIN_STATIC_REGISTER(videoparsersbad);
+  GST_PLUGIN_STATIC_REGISTER(audioparsers);
+  GST_PLUGIN_STATIC_REGISTER(deinterlace);
+  GST_PLUGIN_STATIC_REGISTER(videofilter);
+  GST_PLUGIN_STATIC_REGISTER(debugutilsbad);
+#endif
+
+  s_loadMsec = timer.elapsed();
+  return true;
+}
+
+bool MediaLoader::loaded() {
+  return s_loaded;
+}
+
+/* How long load() took, or -1 if media was never needed. */
+qint64 MediaLoader::loadMsec() {
+  return s_loadMsec;
+}
@@ -0,0 +1,26 @@
+#ifndef MEDIALOADER_H
+#define MEDIALOADER_H
+
+#include <QtGlobal>
+
+/* Registers the GStreamer plugins a static build links in, in two steps.
+ * initialize() only registers what WebKit needs to see media as supported
+ * and to build a pipeline; the demuxers, parsers and decoders, by far the
+ * larger part, are registered by load() once a page first asks for media.
+ * Builds against a system GStreamer already load plugins on demand from
+ * its registry, so there both only initialize GStreamer. */
+class MediaLoader
+{
+public:
+  static void initialize();
+  static bool load();
+  static bool loaded();
+  static qint64 loadMsec();
+
+private:
+  static bool s_initialized;
+  static bool s_loaded;
+  static qint64 s_loadMsec;
+};
+
+#endif // MEDIALOADER_H
@@ -0,0 +1,428 @@
+#include "memorybudget.h"
+#include <QWebSettings>
+#include <QRunnable>
+#include <QAtomicInt>
+#include <QMutex>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <strings.h>
+#include <sys/mman.h>
+#endif
+
+/* Minimum time between two escalation steps, so the previous step gets a
+ * chance to show up in the resident size. */
+#define MEMORY_ESCALATE_MSEC 2000
+#define MEMORY_RELOAD_MSEC 30000
+
+/* Fraction of the budget, in percent, below which pressure counts as gone. */
+#define MEMORY_RELAX_PERCENT 80
+
+/* Pages kept for instant back and forward without a budget. */
+#define MEMORY_DEFAULT_PAGES_IN_CACHE 3
+
+/* WebKit's own object cache capacities, which QWebSettings can set but not
+ * read back; a budget that is lifted puts these back. */
+#define MEMORY_DEFAULT_CACHE_MIN_DEAD 0
+#define MEMORY_DEFAULT_CACHE_MAX_DEAD (8 * 1024 * 1024)
+#define MEMORY_DEFAULT_CACHE_TOTAL (8 * 1024 * 1024)
+
+/* Fonts registered from memory rather than from a file of their own. */
+#define MEMORY_FONT_DATA_MAX 8
+
+struct FontData {
+  const uchar *data;
+  qint64 size;
+};
+
+static FontData font_data[MEMORY_FONT_DATA_MAX];
+static int font_data_count;
+static QMutex font_data_lock;
+
+/* Walks the mappings on a pool thread, so the frame thread only picks up
+ * the result. */
+class MappingsWalk : public QRunnable
+{
+public:
+  MappingsWalk(const MemoryUsage &usage) :
+    usage(usage)
+    ,done(0)
+  {
+    setAutoDelete(false);
+  }
+
+  void run() {
+    MemoryBudget::readMappings(usage);
+    done.storeRelease(1);
+  }
+
+  MemoryUsage usage;
+  QAtomicInt done;
+};
+
+MemoryUsage::MemoryUsage() :
+  resident(0)
+  ,frameBuffers(0)
+  ,tabStates(0)
+  ,network(0)
+  ,objectCache(0)
+  ,fonts(0)
+  ,code(0)
+  ,files(0)
+  ,anonymous(0)
+{
+}
+
+MemoryBudget::MemoryBudget() :
+  m_budget(0)
+  ,m_resident(0)
+  ,m_level(ActionNone)
+  ,m_discardable(0)
+  ,m_cacheTotal(0)
+  ,m_pagesInCache(MEMORY_DEFAULT_PAGES_IN_CACHE)
+  ,m_lastAction()
+  ,m_lastReload()
+  ,m_peak()
+  ,m_walk(0)
+  ,m_walkPool()
+{
+  m_walkPool.setMaxThreadCount(1);
+  QWebSettings::setMaximumPagesInCache(m_pagesInCache);
+}
+
+MemoryBudget::~MemoryBudget()
+{
+  m_walkPool.waitForDone();
+  delete m_walk;
+}
+
+/* A budget of 0 means unlimited and gives WebKit back its own cache sizes.
+ * The page cache is always on, but holds fewer pages the smaller the
+ * budget. */
+void MemoryBudget::setBudget(qint64 bytes) {
+  if(bytes == m_budget)
+    return;
+
+  m_budget = bytes;
+  m_level = ActionNone;
+
+  if(m_budget <= 0) {
+    if(m_cacheTotal > 0)
+      QWebSettings::setObjectCacheCapacities(MEMORY_DEFAULT_CACHE_MIN_DEAD, MEMORY_DEFAULT_CACHE_MAX_DEAD, MEMORY_DEFAULT_CACHE_TOTAL);
+
+    m_cacheTotal = 0;
+    m_pagesInCache = MEMORY_DEFAULT_PAGES_IN_CACHE;
+    QWebSettings::setMaximumPagesInCache(m_pagesInCache);
+    return;
+  }
+
+  m_cacheTotal = (int)qBound((qint64)4 * 1024 * 1024, m_budget / 8, (qint64)64 * 1024 * 1024);
+
+  if(m_budget >= (qint64)512 * 1024 * 1024)
+    m_pagesInCache = 3;
+  else if(m_budget >= (qint64)256 * 1024 * 1024)
+    m_pagesInCache = 2;
+  else
+    m_pagesInCache = 1;
+
+  applyCapacities();
+  QWebSettings::setMaximumPagesInCache(m_pagesInCache);
+}
+
+/* Background tabs the caller can still discard. While there are any, they
+ * go before the visible page is reloaded. */
+void MemoryBudget::setDiscardableTabs(int count) {
+  m_discardable = count;
+}
+
+qint64 MemoryBudget::budget() const {
+  return m_budget;
+}
+
+qint64 MemoryBudget::lastResident() const {
+  return m_resident;
+}
+
+MemoryBudget::Action MemoryBudget::sample() {
+  Action action;
+
+  if(m_budget <= 0)
+    return ActionNone;
+
+  m_resident = residentSetSize();
+
+  if(m_resident < 0)
+    return ActionNone;
+
+  if(m_resident < m_budget * MEMORY_RELAX_PERCENT / 100) {
+    if(m_level >= ActionDropPageCache)
+      QWebSettings::setMaximumPagesInCache(m_pagesInCache);
+
+    m_level = ActionNone;
+    return ActionNone;
+  }
+
+  if(m_resident <= m_budget)
+    return ActionNone;
+
+  if(m_lastAction.isValid() && m_lastAction.elapsed() < MEMORY_ESCALATE_MSEC)
+    return ActionNone;
+
+  action = (Action)qMin(m_level + 1, (int)ActionReload);
+
+  if(action == ActionDiscardTab && m_discardable == 0)
+    action = ActionReload;
+  else if(action == ActionReload && m_discardable > 0)
+    action = ActionDiscardTab;
+
+  if(action == ActionReload && m_lastReload.isValid() && m_lastReload.elapsed() < MEMORY_RELOAD_MSEC)
+    return ActionNone;
+
+  switch(action) {
+    case ActionPurgeDecoded:
+      // shrinking the object cache prunes dead resources and decoded images
+      QWebSettings::setObjectCacheCapacities(0, 0, 0);
+      applyCapacities();
+      break;
+    case ActionClearMemoryCaches:
+      QWebSettings::clearMemoryCaches();
+      break;
+    case ActionDropPageCache:
+      QWebSettings::setMaximumPagesInCache(0);
+      QWebSettings::clearMemoryCaches();
+      break;
+    case ActionDiscardTab:
+      // performed by the owner of the tabs, as is the reload
+      break;
+    case ActionReload:
+      m_lastReload.start();
+      break;
+    default:
+      break;
+  }
+
+  m_level = action;
+  m_lastAction.start();
+
+  return action;
+}
+
+/* Starts breaking the resident size down, filling in the parts the caller
+ * knows; the mappings are read off the frame thread. Does nothing while
+ * the previous breakdown is still being read. The object cache is reported
+ * as 0 while WebKit picks its own capacity, which happens without a
+ * budget. */
+void MemoryBudget::startAccount(qint64 frameBuffers, qint64 tabStates, qint64 network) {
+  MemoryUsage usage;
+
+  if(m_walk)
+    return;
+
+  usage.resident = residentSetSize();
+  usage.frameBuffers = frameBuffers;
+  usage.tabStates = tabStates;
+  usage.network = network;
+  usage.objectCache = m_budget > 0 ? m_cacheTotal : 0;
+
+  m_walk = new MappingsWalk(usage);
+  m_walkPool.start(m_walk);
+}
+
+/* Returns true with the breakdown from startAccount() once it is done,
+ * and raises the high-water marks. */
+bool MemoryBudget::takeAccount(MemoryUsage &usage) {
+  if(!m_walk || !m_walk->done.loadAcquire())
+    return false;
+
+  usage = m_walk->usage;
+  delete m_walk;
+  m_walk = 0;
+
+  m_peak.resident = qMax(m_peak.resident, usage.resident);
+  m_peak.frameBuffers = qMax(m_peak.frameBuffers, usage.frameBuffers);
+  m_peak.tabStates = qMax(m_peak.tabStates, usage.tabStates);
+  m_peak.network = qMax(m_peak.network, usage.network);
+  m_peak.objectCache = qMax(m_peak.objectCache, usage.objectCache);
+  m_peak.fonts = qMax(m_peak.fonts, usage.fonts);
+  m_peak.code = qMax(m_peak.code, usage.code);
+  m_peak.files = qMax(m_peak.files, usage.files);
+  m_peak.anonymous = qMax(m_peak.anonymous, usage.anonymous);
+
+  return true;
+}
+
+/* The highest value each field of takeAccount() has reached. */
+const MemoryUsage& MemoryBudget::peak() const {
+  return m_peak;
+}
+
+void MemoryBudget::applyCapacities() {
+  QWebSettings::setObjectCacheCapacities(m_cacheTotal / 8, m_cacheTotal / 4, m_cacheTotal);
+}
+
+/* Returns -1 where the resident size can't be read cheaply. Read every
+ * few frames, so it goes through a stack buffer rather than stdio, which
+ * allocates a buffer per stream. */
+qint64 MemoryBudget::residentSetSize() {
+#ifdef __linux__
+  long long pages = -1;
+  char buf[64];
+  ssize_t len;
+  int fd = open("/proc/self/statm", O_RDONLY);
+
+  if(fd < 0)
+    return -1;
+
+  len = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+
+  if(len <= 0)
+    return -1;
+
+  buf[len] = '\0';
+
+  if(sscanf(buf, "%*s %lld", &pages) != 1)
+    pages = -1;
+
+  return pages < 0 ? -1 : (qint64)pages * sysconf(_SC_PAGESIZE);
+#else
+  return -1;
+#endif
+}
+
+#ifdef __linux__
+static bool isFont(const char *path) {
+  static const char *exts[] = { ".ttf", ".otf", ".ttc", ".pcf", ".pfb" };
+  size_t len = strlen(path);
+
+  for(size_t i = 0; i < sizeof(exts) / sizeof(exts[0]); i++) {
+    size_t ext = strlen(exts[i]);
+
+    if(len > ext && !strcasecmp(path + len - ext, exts[i]))
+      return true;
+  }
+
+  return false;
+}
+
+/* Resident bytes of the fonts registered from memory that lie within the
+ * mapping from @start to @end. */
+static qint64 fontResident(unsigned long long start, unsigned long long end) {
+  QMutexLocker locker(&font_data_lock);
+  long page = sysconf(_SC_PAGESIZE);
+  qint64 bytes = 0;
+
+  for(int i = 0; i < font_data_count; i++) {
+    unsigned long long from = (unsigned long long)font_data[i].data & ~(unsigned long long)(page - 1);
+    unsigned long long to = (unsigned long long)font_data[i].data + font_data[i].size;
+    unsigned char vec[256];
+
+    if(from < start || to > end)
+      continue;
+
+    // mincore() reports residency a page at a time
+    for(; from < to; from += sizeof(vec) * page) {
+      size_t len = qMin((unsigned long long)sizeof(vec) * page, to - from);
+
+      if(mincore((void*)from, len, vec) != 0)
+        break;
+
+      for(size_t p = 0; p < (len + page - 1) / page; p++)
+        bytes += (vec[p] & 1) ? page : 0;
+    }
+  }
+
+  return bytes;
+}
+#endif
+
+/* Fonts registered from data mapped out of a larger file, such as one
+ * embedded in the core's resources, are counted as fonts rather than as
+ * part of that file. */
+void MemoryBudget::addFontData(const uchar *data, qint64 size) {
+  QMutexLocker locker(&font_data_lock);
+
+  if(font_data_count < MEMORY_FONT_DATA_MAX) {
+    font_data[font_data_count].data = data;
+    font_data[font_data_count].size = size;
+    font_data_count++;
+  }
+}
+
+/* Sorts the resident part of every mapping into fonts, code, other files
+ * and anonymous memory. Walks all of /proc/self/smaps, which takes long
+ * enough that startAccount() runs it on a pool thread. */
+bool MemoryBudget::readMappings(MemoryUsage &usage) {
+#ifdef __linux__
+  char line[512];
+  char path[512];
+  qint64 *bucket = &usage.anonymous;
+  qint64 fonts = 0;
+  unsigned long long start;
+  unsigned long long end;
+  long long kb;
+  FILE *f = fopen("/proc/self/smaps", "r");
+
+  if(!f)
+    return false;
+
+  while(fgets(line, sizeof(line), f)) {
+    size_t token = strcspn(line, " ");
+
+    // fields are "Name: value", anything else starts a new mapping
+    if(token > 0 && line[token - 1] != ':') {
+      path[0] = '\0';
+      fonts = 0;
+
+      if(sscanf(line, "%*s %*s %*s %*s %*s %511[^\n]", path) != 1 || path[0] == '[')
+        bucket = &usage.anonymous;
+      else if(isFont(path))
+        bucket = &usage.fonts;
+      else if(strstr(path, ".so"))
+        bucket = &usage.code;
+      else
+        bucket = &usage.files;
+
+      if(bucket != &usage.fonts && sscanf(line, "%llx-%llx", &start, &end) == 2)
+        fonts = fontResident(start, end);
+
+      continue;
+    }
+
+    if(sscanf(line, "Rss: %lld kB", &kb) == 1) {
+      qint64 rss = (qint64)kb * 1024;
+
+      fonts = qMin(fonts, rss);
+      usage.fonts += fonts;
+      *bucket += rss - fonts;
+    }
+  }
+
+  fclose(f);
+
+  return true;
+#else
+  (void)usage;
+  return false;
+#endif
+}
+
+const char* MemoryBudget::actionName(Action action) {
+  switch(action) {
+    case ActionPurgeDecoded:
+      return "purged decoded images";
+    case ActionClearMemoryCaches:
+      return "cleared memory caches";
+    case ActionDropPageCache:
+      return "dropped page cache";
+    case ActionDiscardTab:
+      return "discarded background tab";
+    case ActionReload:
+      return "reloaded page";
+    default:
+      return "none";
+  }
+}
@@ -0,0 +1,80 @@
+#ifndef MEMORYBUDGET_H
+#define MEMORYBUDGET_H
+
+#include <QtGlobal>
+#include <QElapsedTimer>
+#include <QThreadPool>
+
+class MappingsWalk;
+
+/* Where resident memory goes, in bytes. What the browser holds itself is
+ * exact and mapped files are read from the kernel. WebKit only reveals the
+ * capacity of its object cache, which bounds the decoded images and
+ * resources it keeps; the JavaScript heap, DOM and render trees live in
+ * anonymous memory along with every other allocation. */
+struct MemoryUsage {
+  MemoryUsage();
+
+  qint64 resident;
+  qint64 frameBuffers;
+  qint64 tabStates;
+  qint64 network;
+  qint64 objectCache;
+  qint64 fonts;
+  qint64 code;
+  qint64 files;
+  qint64 anonymous;
+};
+
+/* Keeps the process under a resident memory budget. WebKit's caches are
+ * sized from the budget up front, and each time sample() finds the process
+ * over budget it escalates one step further, from cheap to disruptive.
+ * Those caches are shared by every page in the process, so there must be
+ * only one budget, owned by whatever hosts the pages; discarding a tab and
+ * reloading a page are left to that owner. */
+class MemoryBudget
+{
+public:
+  enum Action {
+    ActionNone,
+    ActionPurgeDecoded,
+    ActionClearMemoryCaches,
+    ActionDropPageCache,
+    ActionDiscardTab,
+    ActionReload
+  };
+
+  MemoryBudget();
+  ~MemoryBudget();
+
+  void setBudget(qint64 bytes);
+  void setDiscardableTabs(int count);
+  qint64 budget() const;
+  qint64 lastResident() const;
+  Action sample();
+  void startAccount(qint64 frameBuffers, qint64 tabStates, qint64 network);
+  bool takeAccount(MemoryUsage &usage);
+  const MemoryUsage& peak() const;
+
+  static qint64 residentSetSize();
+  static bool readMappings(MemoryUsage &usage);
+  static void addFontData(const uchar *data, qint64 size);
+  static const char* actionName(Action action);
+
+private:
+  void applyCapacities();
+
+  qint64 m_budget;
+  qint64 m_resident;
+  int m_level;
+  int m_discardable;
+  int m_cacheTotal;
+  int m_pagesInCache;
+  QElapsedTimer m_lastAction;
+  QElapsedTimer m_lastReload;
+  MemoryUsage m_peak;
+  MappingsWalk *m_walk;
+  QThreadPool m_walkPool;
+};
+
+#endif // MEMORYBUDGET_H
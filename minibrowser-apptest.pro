@@ -13,8 +13,43 @@ TEMPLATE = app
 
 
 SOURCES += main.cpp\
-        minibrowser.cpp
+        minibrowser.cpp \
+        networkaccessmanager.cpp \
+        contentblocker.cpp \
+        imagetranscoder.cpp \
+        memorybudget.cpp \
+        framepacer.cpp \
+        inputrecorder.cpp \
+        replayclock.cpp \
+        scalegovernor.cpp \
+        compositor.cpp \
+        pagestate.cpp \
+        pagemetrics.cpp \
+        medialoader.cpp \
+        corelog.cpp \
+        scriptwatchdog.cpp \
+        webpage.cpp
 
-HEADERS  += minibrowser.h
+HEADERS  += minibrowser.h \
+            networkaccessmanager.h \
+            contentblocker.h \
+            imagetranscoder.h \
+            memorybudget.h \
+            framepacer.h \
+            inputrecorder.h \
+            replayclock.h \
+            scalegovernor.h \
+            compositor.h \
+            pagestate.h \
+            pagemetrics.h \
+            medialoader.h \
+            corelog.h \
+            scriptwatchdog.h \
+            webpage.h \
+            allochook.h
 
 FORMS    += minibrowser.ui
+
+# media plugins are registered by the browser, see medialoader.h
+CONFIG += link_pkgconfig
+PKGCONFIG += gstreamer-1.0
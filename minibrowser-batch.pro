@@ -0,0 +1,60 @@
+#-------------------------------------------------
+#
+# Headless batch renderer: pages to PNG with a pool
+# of worker processes
+#
+#-------------------------------------------------
+
+QT       += core gui webkit webkitwidgets
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+TARGET = minibrowser-batch
+TEMPLATE = app
+CONFIG += console
+
+
+SOURCES += batch.cpp\
+        batchrenderer.cpp \
+        minibrowser.cpp \
+        networkaccessmanager.cpp \
+        contentblocker.cpp \
+        imagetranscoder.cpp \
+        memorybudget.cpp \
+        framepacer.cpp \
+        inputrecorder.cpp \
+        replayclock.cpp \
+        scalegovernor.cpp \
+        compositor.cpp \
+        pagestate.cpp \
+        pagemetrics.cpp \
+        medialoader.cpp \
+        corelog.cpp \
+        scriptwatchdog.cpp \
+        webpage.cpp
+
+HEADERS  += batchrenderer.h \
+            minibrowser.h \
+            networkaccessmanager.h \
+            contentblocker.h \
+            imagetranscoder.h \
+            memorybudget.h \
+            framepacer.h \
+            inputrecorder.h \
+            replayclock.h \
+            scalegovernor.h \
+            compositor.h \
+            pagestate.h \
+            pagemetrics.h \
+            medialoader.h \
+            corelog.h \
+            scriptwatchdog.h \
+            webpage.h \
+            allochook.h
+
+# the workers render with the browser's own views
+FORMS    += minibrowser.ui
+
+# media plugins are registered by the browser, see medialoader.h
+CONFIG += link_pkgconfig
+PKGCONFIG += gstreamer-1.0
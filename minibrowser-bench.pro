@@ -0,0 +1,63 @@
+#-------------------------------------------------
+#
+# Microbenchmarks of the core's per-frame work
+#
+#-------------------------------------------------
+
+QT       += core gui webkit webkitwidgets
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+TARGET = minibrowser-bench
+TEMPLATE = app
+CONFIG += console
+
+# no static platform plugin, see libretro.cpp
+DEFINES += SHARED
+
+# heap allocations are counted, see allochook.h
+DEFINES += ALLOC_COUNT
+
+SOURCES += bench.cpp\
+        minibrowser.cpp \
+        networkaccessmanager.cpp \
+        contentblocker.cpp \
+        imagetranscoder.cpp \
+        memorybudget.cpp \
+        framepacer.cpp \
+        inputrecorder.cpp \
+        replayclock.cpp \
+        scalegovernor.cpp \
+        compositor.cpp \
+        pagestate.cpp \
+        pagemetrics.cpp \
+        medialoader.cpp \
+        corelog.cpp \
+        scriptwatchdog.cpp \
+        webpage.cpp
+
+HEADERS  += minibrowser.h \
+            networkaccessmanager.h \
+            contentblocker.h \
+            imagetranscoder.h \
+            memorybudget.h \
+            framepacer.h \
+            inputrecorder.h \
+            replayclock.h \
+            scalegovernor.h \
+            compositor.h \
+            pagestate.h \
+            pagemetrics.h \
+            medialoader.h \
+            corelog.h \
+            scriptwatchdog.h \
+            webpage.h \
+            allochook.h
+
+FORMS    += minibrowser.ui
+
+# media plugins are registered by the browser, see medialoader.h
+CONFIG += link_pkgconfig
+PKGCONFIG += gstreamer-1.0
+
+RESOURCES = res.qrc
@@ -1,29 +1,120 @@
 #include "minibrowser.h"
 #include "ui_minibrowser.h"
+#include "networkaccessmanager.h"
+#include "pagestate.h"
+#include "pagemetrics.h"
+#include "replayclock.h"
+#include "medialoader.h"
+#include "webpage.h"
+#include "allochook.h"
 #include "libretro.h"
 #include <stdio.h>
 #include <QKeyEvent>
 #include <QMouseEvent>
+#include <QPaintEvent>
+#include <QPainter>
+#include <QWebPage>
+#include <QWebFrame>
+#include <QWebElement>
+#include <QWebHistory>
+#include <QDir>
 
 #define JOYPAD_MOUSE_SPEED 20
+#define START_URL "https://www.youtube.com/"
+
+/* How long a saved session is reused before scroll position and form
+ * contents are captured again. Navigation always invalidates it. */
+#define SESSION_CACHE_MSEC 500
+
+/* Shoulder and stick buttons are reported every frame while held. */
+#define TAB_INPUT_REPEAT_MSEC 400
+
+/* History entries per tab that keep a snapshot of how their page last
+ * looked, and the size it is kept at relative to the page. */
+#define HISTORY_SNAPSHOTS 4
+#define HISTORY_SNAPSHOT_PERCENT 50
+
+/* Longest a snapshot stands in for a page that is still loading. */
+#define HISTORY_SNAPSHOT_MSEC 5000
+
+/* Pages kept alive at once; older background tabs are discarded to their
+ * serialized state even without memory pressure. */
+#define MAX_LIVE_TABS 4
+
+/* Longest an image outside the viewport is held back, unless images are
+ * only loaded on demand. */
+#define IMAGE_DEFERRAL_MSEC 10000
+
+/* How often the page is searched for a playing video. */
+#define VIDEO_CHECK_MSEC 250
+#define VIDEO_PLAYING_SCRIPT "Array.prototype.some.call(document.getElementsByTagName('video'), " \
+    "function(video) { return !video.paused && !video.ended; })"
 
 MiniBrowser::MiniBrowser(QWidget *parent) :
   QWidget(parent)
   ,ui(new Ui::MiniBrowser)
+  ,m_network(new NetworkAccessManager(this))
   ,m_img(320, 240, QImage::Format_RGB32)
   ,m_format(QImage::Format_RGB32)
-  ,m_cursor()
   ,m_cursorEnabled(false)
   ,m_mousePos()
   ,m_mouseLeftDown(false)
   ,m_mouseRightDown(false)
   ,m_selectDown(false)
+  ,m_session()
+  ,m_sessionAge()
+  ,m_sessionDirty(true)
+  ,m_pageLoaded(false)
+  ,m_tabs()
+  ,m_currentTab(-1)
+  ,m_tabInput()
+  ,m_snapshotShown()
+  ,m_videoPlaying(false)
+  ,m_videoCheck()
+  ,m_updates(0)
+  ,m_clock(0)
+  ,m_renderScale(100)
+  ,m_scaled()
+  ,m_scaledPainter()
+  ,m_compositor()
+  ,m_chromeLayer(m_compositor.addLayer(true))
+  ,m_pageLayer(m_compositor.addLayer(true))
+  ,m_overlayLayer(m_compositor.addLayer(false))
+  ,m_cursorLayer(m_compositor.addLayer(false))
+  ,m_pageDamage()
+  ,m_chromeDamage()
+  ,m_compositing(false)
+  ,m_painted(false)
+  ,m_pageScroll()
+  ,m_metrics(new PageMetrics(this))
+  ,m_watchdog()
+  ,m_keyText()
 {
   ui->setupUi(this);
-  ui->webView->settings()->setAttribute(QWebSettings::DeveloperExtrasEnabled, true);
-  ui->webView->settings()->setAttribute(QWebSettings::PluginsEnabled, true);
+
+  // key events carry at most one character
+  m_keyText.reserve(2);
+
+  installEventFilter(this);
+
+  foreach(QWidget *child, findChildren<QWidget*>())
+    child->installEventFilter(this);
+
+  m_compositor.setVisible(m_overlayLayer, false);
+
+  // every tab's page falls back to these unless told otherwise
+  QWebSettings::globalSettings()->setAttribute(QWebSettings::DeveloperExtrasEnabled, true);
+  QWebSettings::globalSettings()->setAttribute(QWebSettings::PluginsEnabled, true);
+
+  connect(m_network, SIGNAL(replyCreated(QNetworkReply*)), m_metrics, SLOT(onReplyCreated(QNetworkReply*)));
+  connect(m_network, SIGNAL(mediaRequested()), this, SLOT(onMediaRequested()));
+
+  newTab();
 
   connect(ui->urlLineEdit, SIGNAL(returnPressed()), this, SLOT(onURLChanged()));
+  connect(ui->webView, SIGNAL(urlChanged(QUrl)), this, SLOT(onSessionChanged()));
+  connect(ui->webView, SIGNAL(loadFinished(bool)), this, SLOT(onSessionChanged()));
+  connect(ui->webView, SIGNAL(loadFinished(bool)), this, SLOT(onLoadFinished()));
 }
 
 MiniBrowser::~MiniBrowser()
@@ -31,6 +122,218 @@ MiniBrowser::~MiniBrowser()
   delete ui;
 }
 
+/* Pages belong to the browser rather than the view, so the view can switch
+ * between them without deleting any. */
+QWebPage* MiniBrowser::createPage() {
+  QWebPage *page = new WebPage(&m_watchdog, this);
+
+  // must be installed before the first load so every request is scheduled
+  page->setNetworkAccessManager(m_network);
+  page->setVisibilityState(QWebPage::VisibilityStateHidden);
+
+  if(m_clock)
+    m_clock->attach(page);
+
+  connect(page, SIGNAL(loadStarted()), this, SLOT(onLoadStarted()));
+
+  return page;
+}
+
+void MiniBrowser::activateTab(int index) {
+  Tab &tab = m_tabs[index];
+  bool restore = !tab.page;
+
+  if(m_currentTab >= 0 && m_currentTab < m_tabs.size() && m_currentTab != index && m_tabs[m_currentTab].page)
+    m_tabs[m_currentTab].page->setVisibilityState(QWebPage::VisibilityStateHidden);
+
+  if(!tab.page)
+    tab.page = createPage();
+
+  m_currentTab = index;
+  tab.lastUsed.start();
+
+  // only the page attached to the view is ever laid out for and painted
+  ui->webView->setPage(tab.page);
+  tab.page->setVisibilityState(QWebPage::VisibilityStateVisible);
+  m_network->setPage(tab.page);
+  m_metrics->setPage(tab.page);
+  m_sessionDirty = true;
+  hideSnapshot();
+
+  if(restore && !tab.state.isEmpty()) {
+    PageState::restore(tab.page, tab.state);
+    tab.state.clear();
+  }
+
+  while(liveBackgroundTabs() + 1 > MAX_LIVE_TABS && discardTab())
+    ;
+
+  ui->webView->setFocus();
+}
+
+/* Serializes the least recently used background tab and frees its page.
+ * Returns false if there is none. */
+bool MiniBrowser::discardTab() {
+  int victim = -1;
+
+  for(int i = 0; i < m_tabs.size(); i++) {
+    if(i == m_currentTab || !m_tabs[i].page)
+      continue;
+
+    if(victim < 0 || m_tabs[i].lastUsed < m_tabs[victim].lastUsed)
+      victim = i;
+  }
+
+  if(victim < 0)
+    return false;
+
+  Tab &tab = m_tabs[victim];
+
+  tab.state = PageState::save(tab.page);
+  tab.snapshots.clear();
+  delete tab.page;
+  tab.page = 0;
+
+  return true;
+}
+
+int MiniBrowser::liveBackgroundTabs() const {
+  int count = 0;
+
+  for(int i = 0; i < m_tabs.size(); i++) {
+    if(i != m_currentTab && m_tabs[i].page)
+      count++;
+  }
+
+  return count;
+}
+
+void MiniBrowser::newTab(const QUrl &url) {
+  Tab tab;
+
+  tab.page = 0;
+  m_tabs.append(tab);
+  activateTab(m_tabs.size() - 1);
+
+  if(!url.isEmpty())
+    ui->webView->setUrl(url);
+}
+
+void MiniBrowser::closeTab() {
+  if(m_tabs.size() <= 1)
+    return;
+
+  int index = m_currentTab;
+  QWebPage *page = m_tabs.takeAt(index).page;
+
+  m_currentTab = -1;
+  activateTab(qMin(index, m_tabs.size() - 1));
+
+  if(page)
+    page->deleteLater();
+}
+
+void MiniBrowser::switchTab(int offset) {
+  if(m_tabs.size() <= 1)
+    return;
+
+  int index = (m_currentTab + offset) % m_tabs.size();
+
+  if(index < 0)
+    index += m_tabs.size();
+
+  activateTab(index);
+}
+
+int MiniBrowser::tabCount() const {
+  return m_tabs.size();
+}
+
+int MiniBrowser::currentTab() const {
+  return m_currentTab;
+}
+
+/* Pages left this way stay in WebKit's page cache and come back without a
+ * reload; until the page is back, the snapshot of how it last looked is
+ * shown in its place. */
+void MiniBrowser::goBack() {
+  QWebHistory *history = ui->webView->page()->history();
+
+  if(!history->canGoBack())
+    return;
+
+  showSnapshot(history->currentItemIndex() - 1);
+  history->back();
+}
+
+void MiniBrowser::goForward() {
+  QWebHistory *history = ui->webView->page()->history();
+
+  if(!history->canGoForward())
+    return;
+
+  showSnapshot(history->currentItemIndex() + 1);
+  history->forward();
+}
+
+/* Keeps what the visible page looks like, at a reduced size, for when its
+ * history entry is navigated back to. The entries furthest from the
+ * current one lose theirs first. */
+void MiniBrowser::saveSnapshot() {
+  QWebHistory *history = ui->webView->page()->history();
+  QWebHistoryItem item = history->currentItem();
+  const QImage &page = m_compositor.image(m_pageLayer);
+  QHash<int, Snapshot> &snapshots = m_tabs[m_currentTab].snapshots;
+  int current = history->currentItemIndex();
+  Snapshot snapshot;
+
+  if(!item.isValid() || page.isNull())
+    return;
+
+  snapshot.url = item.url();
+  snapshot.image = page.scaled(page.size() * HISTORY_SNAPSHOT_PERCENT / 100, Qt::IgnoreAspectRatio, Qt::FastTransformation);
+  snapshots[current] = snapshot;
+
+  while(snapshots.size() > HISTORY_SNAPSHOTS) {
+    int furthest = current;
+
+    foreach(int index, snapshots.keys()) {
+      if(qAbs(index - current) > qAbs(furthest - current))
+        furthest = index;
+    }
+
+    snapshots.remove(furthest);
+  }
+}
+
+void MiniBrowser::showSnapshot(int index) {
+  const QHash<int, Snapshot> &snapshots = m_tabs[m_currentTab].snapshots;
+  QWebHistory *history = ui->webView->page()->history();
+  QRect page = m_compositor.geometry(m_pageLayer);
+
+  if(!snapshots.contains(index) || page.isEmpty())
+    return;
+
+  // the entry may have been replaced by a later navigation
+  if(snapshots[index].url != history->itemAt(index).url())
+    return;
+
+  setOverlay(snapshots[index].image.scaled(page.size(), Qt::IgnoreAspectRatio, Qt::FastTransformation), page.topLeft());
+  m_snapshotShown.start();
+}
+
+void MiniBrowser::hideSnapshot() {
+  if(!m_snapshotShown.isValid())
+    return;
+
+  setOverlay(QImage());
+  m_snapshotShown.invalidate();
+}
+
+void MiniBrowser::loadStartPage() {
+  ui->webView->setUrl(QUrl(START_URL));
+}
+
 void MiniBrowser::onURLChanged() {
   QString text = ui->urlLineEdit->text();
 
@@ -40,29 +343,320 @@ void MiniBrowser::onURLChanged() {
   ui->webView->setUrl(text);
 }
 
+/* The bounds of what is left of @outer once @inner is taken out, worked
+ * out without a QRegion since it is needed every frame. */
+static QRect remainder(const QRect &outer, const QRect &inner) {
+  bool wide = inner.left() <= outer.left() && inner.right() >= outer.right();
+  bool tall = inner.top() <= outer.top() && inner.bottom() >= outer.bottom();
+  QRect rect = outer;
+
+  if(wide && tall)
+    return QRect();
+
+  // only a strip along one side is left over
+  if(wide && inner.top() <= outer.top())
+    rect.setTop(inner.bottom() + 1);
+  else if(wide && inner.bottom() >= outer.bottom())
+    rect.setBottom(inner.top() - 1);
+  else if(tall && inner.left() <= outer.left())
+    rect.setLeft(inner.right() + 1);
+  else if(tall && inner.right() >= outer.right())
+    rect.setRight(inner.left() - 1);
+
+  return rect & outer;
+}
+
+/* Paints what changed since the last frame into its layer and composes
+ * the damaged parts of the frame. Damage comes from the paint events the
+ * window's widgets receive when Qt repaints them. */
 void MiniBrowser::render() {
-  if(!m_img.isNull())
-    QWidget::render(&m_img);
+  m_network->updateViewport();
+  updateVideo();
+
+  if(m_img.isNull())
+    return;
+
+  updateLayers();
+
+  // scrolling moves what Qt has already painted and only repaints the
+  // strip that came into view, which says nothing about our copy
+  if(ui->webView->page()->mainFrame()->scrollPosition() != m_pageScroll) {
+    m_pageScroll = ui->webView->page()->mainFrame()->scrollPosition();
+    m_pageDamage.add(QRect(QPoint(), ui->webView->size()));
+  }
+
+  if(m_snapshotShown.isValid() && m_snapshotShown.elapsed() >= HISTORY_SNAPSHOT_MSEC)
+    hideSnapshot();
 
-  if(m_cursorEnabled && !m_cursor.isNull()) {
-    QPainter p(&m_img);
-    p.drawImage(m_mousePos, m_cursor, m_cursor.rect());
+  // our own renders send paint events too, which are not damage
+  m_compositing = true;
+
+  // render() only takes a region, so one is made for each rectangle as
+  // part of the call into Qt
+  if(!m_pageDamage.isEmpty()) {
+    if(m_renderScale < 100) {
+      renderScaled();
+    }else{
+      for(int i = 0; i < m_pageDamage.count(); i++) {
+        const QRect &rect = m_pageDamage.at(i);
+        ALLOC_EXEMPT();
+
+        ui->webView->render(m_compositor.painter(m_pageLayer), rect.topLeft(), QRegion(rect));
+      }
+
+      m_compositor.damage(m_pageLayer, m_pageDamage);
+    }
+
+    m_pageDamage.clear();
   }
+
+  if(!m_chromeDamage.isEmpty()) {
+    QRect chrome = m_compositor.geometry(m_chromeLayer);
+    QRect page(ui->webView->mapTo(this, QPoint()), ui->webView->size());
+
+    for(int i = 0; i < m_chromeDamage.count(); i++) {
+      QRect area = remainder(m_chromeDamage.at(i) & chrome, page);
+
+      if(area.isEmpty())
+        continue;
+
+      {
+        ALLOC_EXEMPT();
+        QWidget::render(m_compositor.painter(m_chromeLayer), area.topLeft() - chrome.topLeft(), QRegion(area));
+      }
+
+      m_compositor.damage(m_chromeLayer, area.translated(-chrome.topLeft()));
+    }
+
+    m_chromeDamage.clear();
+  }
+
+  m_compositing = false;
+
+  drawCursor();
+}
+
+/* Follows the window's layout: the page layer covers the web view, the
+ * chrome layer whatever is around it. */
+void MiniBrowser::updateLayers() {
+  QRect page(ui->webView->mapTo(this, QPoint()), ui->webView->size());
+  QRect chrome = remainder(rect(), page);
+
+  if(m_compositor.geometry(m_pageLayer) != page) {
+    m_compositor.setGeometry(m_pageLayer, page);
+    m_pageDamage.add(QRect(QPoint(), page.size()));
+  }
+
+  if(m_compositor.geometry(m_chromeLayer) != chrome) {
+    m_compositor.setGeometry(m_chromeLayer, chrome);
+    m_chromeDamage.add(chrome);
+  }
+}
+
+/* Paints the whole page at the render scale and stretches the result over
+ * its layer. The raster engine's smooth scaling is bilinear and has SIMD
+ * paths, so the upscale costs far less than the pixels it saves painting. */
+void MiniBrowser::renderScaled() {
+  QImage &layer = m_compositor.image(m_pageLayer);
+  QSize size = layer.size() * m_renderScale / 100;
+  QPainter *p = m_compositor.painter(m_pageLayer);
+
+  if(m_scaled.size() != size) {
+    if(m_scaledPainter.isActive())
+      m_scaledPainter.end();
+
+    m_scaled = QImage(size, layer.format());
+  }
+
+  if(!m_scaledPainter.isActive())
+    m_scaledPainter.begin(&m_scaled);
+
+  // saving the painters' state would allocate, so what is changed is set
+  // back by hand
+  m_scaledPainter.setTransform(QTransform::fromScale((qreal)m_scaled.width() / layer.width(), (qreal)m_scaled.height() / layer.height()));
+  {
+    ALLOC_EXEMPT();
+    ui->webView->render(&m_scaledPainter);
+  }
+
+  p->setRenderHint(QPainter::SmoothPixmapTransform, true);
+  p->drawImage(layer.rect(), m_scaled);
+  p->setRenderHint(QPainter::SmoothPixmapTransform, false);
+
+  m_compositor.damage(m_pageLayer, layer.rect());
+}
+
+/* Percentage of the frame size the page is painted at. */
+void MiniBrowser::setRenderScale(int percent) {
+  percent = qBound(1, percent, 100);
+
+  if(percent == m_renderScale)
+    return;
+
+  m_renderScale = percent;
+  m_pageDamage.add(QRect(QPoint(), m_compositor.geometry(m_pageLayer).size()));
+
+  if(m_renderScale == 100) {
+    if(m_scaledPainter.isActive())
+      m_scaledPainter.end();
+
+    m_scaled = QImage();
+  }
+}
+
+int MiniBrowser::renderScale() const {
+  return m_renderScale;
+}
+
+/* Moves the cursor layer to the mouse and composes the frame. */
+void MiniBrowser::drawCursor() {
+  m_compositor.setVisible(m_cursorLayer, m_cursorEnabled);
+  m_compositor.setPosition(m_cursorLayer, m_mousePos);
+  m_compositor.compose(m_img);
+}
+
+/* Shows @image above the page until called with a null image. */
+void MiniBrowser::setOverlay(const QImage &image, const QPoint &pos) {
+  m_compositor.setImage(m_overlayLayer, image);
+  m_compositor.setPosition(m_overlayLayer, pos);
+  m_compositor.setVisible(m_overlayLayer, !image.isNull());
+}
+
+/* Looks for a playing video now and then, for the frame pacer. Nothing
+ * plays before the media plugins are in, so until then only media elements
+ * are looked for; for those that never make a request of their own, such
+ * as ones playing from a blob, this is what brings the plugins in. After
+ * that one script asks about every video at once. */
+void MiniBrowser::updateVideo() {
+  if(m_videoCheck.isValid() && m_videoCheck.elapsed() < VIDEO_CHECK_MSEC)
+    return;
+
+  m_videoCheck.start();
+  m_videoPlaying = false;
+
+  QWebFrame *frame = ui->webView->page()->mainFrame();
+
+  if(!MediaLoader::loaded()) {
+    bool media;
+
+    {
+      ALLOC_EXEMPT();
+      media = !frame->findFirstElement(QStringLiteral("video, audio")).isNull();
+    }
+
+    if(media)
+      MediaLoader::load();
+
+    return;
+  }
+
+  ALLOC_EXEMPT();
+  m_videoPlaying = frame->evaluateJavaScript(QStringLiteral(VIDEO_PLAYING_SCRIPT)).toBool();
+}
+
+/* Sorts every repaint Qt does into the layer it belongs to. A repaint is
+ * taken by its bounds, which the paint event has without a region copy. */
+bool MiniBrowser::eventFilter(QObject *object, QEvent *event) {
+  ALLOC_COUNTED();
+
+  if(event->type() == QEvent::Paint && !m_compositing && object->isWidgetType()) {
+    QWidget *widget = static_cast<QWidget*>(object);
+    QRect rect = static_cast<QPaintEvent*>(event)->rect();
+
+    if(widget == ui->webView || ui->webView->isAncestorOf(widget))
+      m_pageDamage.add(rect.translated(widget->mapTo(ui->webView, QPoint())));
+    else
+      m_chromeDamage.add(rect.translated(widget == this ? QPoint() : widget->mapTo(this, QPoint())));
+
+    m_painted = true;
+  }
+
+  return QWidget::eventFilter(object, event);
+}
+
+bool MiniBrowser::videoPlaying() const {
+  return m_videoPlaying;
+}
+
+/* Qt posts one update request per event loop pass in which anything in the
+ * window was marked dirty; render() itself doesn't cause any. */
+bool MiniBrowser::event(QEvent *event) {
+  if(event->type() == QEvent::UpdateRequest) {
+    ALLOC_COUNTED();
+    bool handled;
+
+    m_updates++;
+    m_metrics->repainted();
+
+    // a window Qt doesn't consider exposed is never repainted, so the
+    // paint events can't say what changed
+    m_painted = false;
+
+    {
+      ALLOC_EXEMPT();
+      handled = QWidget::event(event);
+    }
+
+    if(!m_painted) {
+      m_pageDamage.add(QRect(QPoint(), ui->webView->size()));
+      m_chromeDamage.add(rect());
+    }
+
+    return handled;
+  }
+
+  return QWidget::event(event);
+}
+
+/* Returns how many times the window needed repainting since the last call. */
+int MiniBrowser::takeUpdates() {
+  int updates = m_updates;
+
+  m_updates = 0;
+  return updates;
 }
 
 void MiniBrowser::resizeEvent(QResizeEvent *) {
+  m_compositor.release();
   m_img = QImage(size(), m_format);
+  m_compositor.damageAll();
 }
 
 void MiniBrowser::setImage(unsigned int width, unsigned int height, QImage::Format format) {
   m_format = format;
+  m_compositor.release();
   m_img = QImage(QSize(width, height), format);
+  m_compositor.damageAll();
 }
 
 const quint8* MiniBrowser::getImage() {
   return m_img.constBits();
 }
 
+const QImage& MiniBrowser::image() const {
+  return m_img;
+}
+
+/* True once any page has finished loading, successfully or not. */
+bool MiniBrowser::pageLoaded() const {
+  return m_pageLoaded;
+}
+
+void MiniBrowser::onLoadFinished() {
+  m_pageLoaded = true;
+  hideSnapshot();
+}
+
+void MiniBrowser::onMediaRequested() {
+  MediaLoader::load();
+}
+
+/* The page being left is still what the view shows. */
+void MiniBrowser::onLoadStarted() {
+  if(sender() == ui->webView->page())
+    saveSnapshot();
+}
+
 void MiniBrowser::onRetroPadInput(int button) {
   switch(button) {
     case RETRO_DEVICE_ID_JOYPAD_SELECT:
@@ -77,6 +671,30 @@ void MiniBrowser::onRetroPadInput(int button) {
         ui->urlLineEdit->setFocus();
       }
       break;
+    case RETRO_DEVICE_ID_JOYPAD_L:
+    case RETRO_DEVICE_ID_JOYPAD_R:
+    case RETRO_DEVICE_ID_JOYPAD_L2:
+    case RETRO_DEVICE_ID_JOYPAD_R2:
+    case RETRO_DEVICE_ID_JOYPAD_L3:
+    case RETRO_DEVICE_ID_JOYPAD_R3:
+      if(m_tabInput.isValid() && m_tabInput.elapsed() < TAB_INPUT_REPEAT_MSEC)
+        break;
+
+      m_tabInput.start();
+
+      if(button == RETRO_DEVICE_ID_JOYPAD_L)
+        goBack();
+      else if(button == RETRO_DEVICE_ID_JOYPAD_R)
+        goForward();
+      else if(button == RETRO_DEVICE_ID_JOYPAD_L2)
+        switchTab(-1);
+      else if(button == RETRO_DEVICE_ID_JOYPAD_R2)
+        switchTab(1);
+      else if(button == RETRO_DEVICE_ID_JOYPAD_L3)
+        newTab(QUrl(START_URL));
+      else
+        closeTab();
+      break;
     case RETRO_DEVICE_ID_JOYPAD_A:
       onMouseInput(QtMouse(m_mousePos, m_mousePos, true, false));
       break;
@@ -99,6 +717,8 @@ void MiniBrowser::onRetroPadInput(int button) {
   m_selectDown = false;
 }
 
+/* Events are sent from the stack rather than posted, which would need a
+ * heap copy of each; the text reuses one buffer. */
 void MiniBrowser::onRetroKeyInput(QtKey key, bool down) {
   if(!down)
     return;
@@ -106,16 +726,17 @@ void MiniBrowser::onRetroKeyInput(QtKey key, bool down) {
   QWidget *widget = qApp->focusWidget();
 
   if(widget) {
-    QString character = "";
+    m_keyText.resize(key.character > 0 ? 1 : 0);
 
     if(key.character > 0)
-      character = key.character;
+      m_keyText[0] = QChar(key.character);
 
-    QKeyEvent *eventDown = new QKeyEvent(QEvent::KeyPress, key.key, key.modifier, character);
-    QKeyEvent *eventUp = new QKeyEvent(QEvent::KeyRelease, key.key, key.modifier, character);
+    QKeyEvent eventDown(QEvent::KeyPress, key.key, key.modifier, m_keyText);
+    QKeyEvent eventUp(QEvent::KeyRelease, key.key, key.modifier, m_keyText);
+    ALLOC_EXEMPT();
 
-    QApplication::postEvent(widget, eventDown);
-    QApplication::postEvent(widget, eventUp);
+    QApplication::sendEvent(widget, &eventDown);
+    QApplication::sendEvent(widget, &eventUp);
   }
 }
 
@@ -131,10 +752,13 @@ void MiniBrowser::onMouseInput(QtMouse mouse) {
       mouse.newPos.setY(qMax(0, mouse.newPos.y()));
 
       m_mousePos = mouse.newPos;
+      // the cursor is composed by render(), so moving it counts as a change
+      m_updates++;
 
-      QMouseEvent *event = new QMouseEvent(QEvent::MouseMove, widget->mapFromGlobal(mouse.newPos), mouse.newPos, Qt::NoButton, Qt::NoButton, Qt::NoModifier);
+      QMouseEvent event(QEvent::MouseMove, widget->mapFromGlobal(mouse.newPos), mouse.newPos, Qt::NoButton, Qt::NoButton, Qt::NoModifier);
+      ALLOC_EXEMPT();
 
-      QApplication::postEvent(widget, event);
+      QApplication::sendEvent(widget, &event);
     }
 
     if(mouse.left) {
@@ -144,6 +768,7 @@ void MiniBrowser::onMouseInput(QtMouse mouse) {
       m_mouseLeftDown = true;
 
       if(!widget->underMouse()) {
+        ALLOC_EXEMPT();
         // shift focus to the widget we just clicked on
         QWidget *w = qApp->widgetAt(m_mousePos);
 
@@ -153,11 +778,12 @@ void MiniBrowser::onMouseInput(QtMouse mouse) {
         }
       }
 
-      QMouseEvent *pressEvent = new QMouseEvent(QEvent::MouseButtonPress, widget->mapFromGlobal(mouse.newPos), mouse.newPos, Qt::LeftButton, Qt::LeftButton, Qt::NoModifier);
-      QMouseEvent *releaseEvent = new QMouseEvent(QEvent::MouseButtonRelease, widget->mapFromGlobal(mouse.newPos), mouse.newPos, Qt::LeftButton, Qt::LeftButton, Qt::NoModifier);
+      QMouseEvent pressEvent(QEvent::MouseButtonPress, widget->mapFromGlobal(mouse.newPos), mouse.newPos, Qt::LeftButton, Qt::LeftButton, Qt::NoModifier);
+      QMouseEvent releaseEvent(QEvent::MouseButtonRelease, widget->mapFromGlobal(mouse.newPos), mouse.newPos, Qt::LeftButton, Qt::LeftButton, Qt::NoModifier);
+      ALLOC_EXEMPT();
 
-      QApplication::postEvent(widget, pressEvent);
-      QApplication::postEvent(widget, releaseEvent);
+      QApplication::sendEvent(widget, &pressEvent);
+      QApplication::sendEvent(widget, &releaseEvent);
     }else{
       m_mouseLeftDown = false;
     }
@@ -168,21 +794,158 @@ void MiniBrowser::onMouseInput(QtMouse mouse) {
 
       m_mouseRightDown = true;
 
-      QMouseEvent *pressEvent = new QMouseEvent(QEvent::MouseButtonPress, widget->mapFromGlobal(mouse.newPos), mouse.newPos, Qt::RightButton, Qt::RightButton, Qt::NoModifier);
-      QMouseEvent *releaseEvent = new QMouseEvent(QEvent::MouseButtonRelease, widget->mapFromGlobal(mouse.newPos), mouse.newPos, Qt::RightButton, Qt::RightButton, Qt::NoModifier);
+      QMouseEvent pressEvent(QEvent::MouseButtonPress, widget->mapFromGlobal(mouse.newPos), mouse.newPos, Qt::RightButton, Qt::RightButton, Qt::NoModifier);
+      QMouseEvent releaseEvent(QEvent::MouseButtonRelease, widget->mapFromGlobal(mouse.newPos), mouse.newPos, Qt::RightButton, Qt::RightButton, Qt::NoModifier);
+      ALLOC_EXEMPT();
 
-      QApplication::postEvent(widget, pressEvent);
-      QApplication::postEvent(widget, releaseEvent);
+      QApplication::sendEvent(widget, &pressEvent);
+      QApplication::sendEvent(widget, &releaseEvent);
     }else{
       m_mouseRightDown = false;
     }
   }
 }
 
+int MiniBrowser::loadContentFilters(const QString &path) {
+  return m_network->contentBlocker()->loadDirectory(path);
+}
+
+/* Lets several views in one process act as one browser towards websites. */
+void MiniBrowser::shareNetwork(MiniBrowser *other) {
+  m_network->shareWith(other->m_network);
+}
+
+/* The current tab's page. */
+QWebPage* MiniBrowser::page() const {
+  return ui->webView->page();
+}
+
+void MiniBrowser::setMaxImageSize(const QSize &size) {
+  m_network->setMaxImageSize(size);
+}
+
+/* Applies to every tab, open or not, from the next layout or load on. */
+void MiniBrowser::setWebAttribute(QWebSettings::WebAttribute attribute, bool on) {
+  QWebSettings::globalSettings()->setAttribute(attribute, on);
+}
+
+void MiniBrowser::setWebFontsEnabled(bool on) {
+  m_network->setFontsEnabled(on);
+}
+
+/* Images away from the viewport wait until scrolled near instead of being
+ * fetched once the deferral runs out. */
+void MiniBrowser::setImagesOnDemand(bool on) {
+  m_network->setMaxDeferral(on ? 0 : IMAGE_DEFERRAL_MSEC);
+}
+
+/* An empty path turns the favicon database off. */
+void MiniBrowser::setIconDatabasePath(const QString &path) {
+  if(path == QWebSettings::iconDatabasePath())
+    return;
+
+  if(!path.isEmpty())
+    QDir().mkpath(path);
+
+  QWebSettings::setIconDatabasePath(path);
+}
+
+/* Adds what this window holds itself to the figures of a memory report. */
+void MiniBrowser::addMemoryHeld(qint64 &frameBuffers, qint64 &tabStates, qint64 &network) const {
+  frameBuffers += m_img.byteCount() + m_scaled.byteCount() + m_compositor.byteCount();
+  tabStates += m_session.size();
+
+  foreach(const Tab &tab, m_tabs) {
+    tabStates += tab.state.size();
+
+    foreach(const Snapshot &snapshot, tab.snapshots)
+      frameBuffers += snapshot.image.byteCount();
+  }
+
+  network += m_network->bufferedBytes();
+}
+
+/* When the least recently used background tab that still has a page was
+ * last shown, comparable across windows; -1 if there is none. */
+qint64 MiniBrowser::oldestBackgroundTab() const {
+  qint64 oldest = -1;
+
+  for(int i = 0; i < m_tabs.size(); i++) {
+    if(i == m_currentTab || !m_tabs[i].page)
+      continue;
+
+    if(oldest < 0 || m_tabs[i].lastUsed.msecsSinceReference() < oldest)
+      oldest = m_tabs[i].lastUsed.msecsSinceReference();
+  }
+
+  return oldest;
+}
+
+void MiniBrowser::reloadPage() {
+  ui->webView->page()->triggerAction(QWebPage::Reload);
+}
+
+/* Cheap enough to be called for every automatic state the frontend takes:
+ * the page is only walked again when the cached copy has gone stale. */
+QByteArray MiniBrowser::saveSession() {
+  if(m_sessionDirty || !m_sessionAge.isValid() || m_sessionAge.elapsed() >= SESSION_CACHE_MSEC) {
+    m_session = PageState::save(ui->webView->page());
+    m_sessionAge.start();
+    m_sessionDirty = false;
+  }
+
+  return m_session;
+}
+
+bool MiniBrowser::restoreSession(const QByteArray &state) {
+  m_sessionDirty = true;
+
+  return PageState::restore(ui->webView->page(), state);
+}
+
+/* From here on every page's scripts run against a clock that only moves
+ * with setClock() and a seeded Math.random(). Documents already loaded keep
+ * the real ones until they navigate. */
+void MiniBrowser::setReplayClock(quint32 seed, qint64 epoch) {
+  delete m_clock;
+  m_clock = new ReplayClock(seed, epoch, this);
+
+  foreach(const Tab &tab, m_tabs) {
+    if(tab.page)
+      m_clock->attach(tab.page);
+  }
+}
+
+/* Appends a line per page load to the CSV at @path; empty turns it off. */
+void MiniBrowser::setMetricsPath(const QString &path) {
+  m_metrics->setOutput(path);
+}
+
+/* Stops scripts WebKit reports as running too long. With @blockOrigins,
+ * their site runs without JavaScript from then on. */
+void MiniBrowser::setScriptWatchdog(bool on, bool blockOrigins) {
+  m_watchdog.setEnabled(on);
+  m_watchdog.setBlockOrigins(blockOrigins);
+}
+
+/* Restarts the script watchdog's clock; call whenever the core is entered. */
+void MiniBrowser::frameStarted() {
+  m_watchdog.frameStarted();
+}
+
+void MiniBrowser::setClock(qint64 msec) {
+  if(m_clock)
+    m_clock->setTime(msec);
+}
+
+void MiniBrowser::onSessionChanged() {
+  m_sessionDirty = true;
+}
+
 void MiniBrowser::setCursorEnabled(bool on) {
   m_cursorEnabled = on;
 
-  if(m_cursorEnabled) {
-    m_cursor = QImage(":/left_ptr.png");
+  if(m_cursorEnabled && m_compositor.image(m_cursorLayer).isNull()) {
+    m_compositor.setImage(m_cursorLayer, QImage(":/left_ptr.png"));
   }
 }
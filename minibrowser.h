@@ -2,6 +2,18 @@
 #define MINIBROWSER_H
 
 #include <QWidget>
+#include <QElapsedTimer>
+#include <QList>
+#include <QHash>
+#include <QUrl>
+#include <QWebSettings>
+#include "compositor.h"
+#include "scriptwatchdog.h"
+
+class QWebPage;
+class NetworkAccessManager;
+class ReplayClock;
+class PageMetrics;
 
 namespace Ui {
   class MiniBrowser;
@@ -41,29 +53,126 @@ public:
   explicit MiniBrowser(QWidget *parent = 0);
   ~MiniBrowser();
   void render();
+  void drawCursor();
+  void setOverlay(const QImage &image, const QPoint &pos = QPoint());
+  void setRenderScale(int percent);
+  int renderScale() const;
   void setImage(unsigned int width, unsigned int height, QImage::Format format);
   const quint8* getImage();
+  const QImage& image() const;
+  bool pageLoaded() const;
+  bool videoPlaying() const;
+  int takeUpdates();
+  void loadStartPage();
   void onRetroPadInput(int button);
   void onRetroKeyInput(QtKey key, bool down);
   void onMouseInput(QtMouse mouse);
   void setCursorEnabled(bool on);
+  int loadContentFilters(const QString &path);
+  void shareNetwork(MiniBrowser *other);
+  QWebPage* page() const;
+  void setMaxImageSize(const QSize &size);
+  void setWebAttribute(QWebSettings::WebAttribute attribute, bool on);
+  void setWebFontsEnabled(bool on);
+  void setImagesOnDemand(bool on);
+  void setIconDatabasePath(const QString &path);
+  void addMemoryHeld(qint64 &frameBuffers, qint64 &tabStates, qint64 &network) const;
+  int liveBackgroundTabs() const;
+  qint64 oldestBackgroundTab() const;
+  bool discardTab();
+  void reloadPage();
+  QByteArray saveSession();
+  bool restoreSession(const QByteArray &state);
+  void newTab(const QUrl &url = QUrl());
+  void closeTab();
+  void switchTab(int offset);
+  int tabCount() const;
+  int currentTab() const;
+  void goBack();
+  void goForward();
+  void setReplayClock(quint32 seed, qint64 epoch);
+  void setClock(qint64 msec);
+  void setMetricsPath(const QString &path);
+  void setScriptWatchdog(bool on, bool blockOrigins);
+  void frameStarted();
 
 private slots:
   void onURLChanged();
+  void onSessionChanged();
+  void onLoadFinished();
+  void onLoadStarted();
+  void onMediaRequested();
 
 protected:
+  bool event(QEvent *event);
+  bool eventFilter(QObject *object, QEvent *event);
   void resizeEvent(QResizeEvent *event);
 
 private:
+  /* How a history entry's page last looked. The URL tells whether the
+   * entry at that index is still the same one. */
+  struct Snapshot {
+    QUrl url;
+    QImage image;
+  };
+
+  /* Hidden tabs keep their page but are never painted; a discarded tab
+   * only keeps the PageState it is brought back from. Snapshots are kept
+   * apart from the history, which is saved with every session, keyed by
+   * history index. */
+  struct Tab {
+    QWebPage *page;
+    QByteArray state;
+    QElapsedTimer lastUsed;
+    QHash<int, Snapshot> snapshots;
+  };
+
+  QWebPage* createPage();
+  void updateVideo();
+  void renderScaled();
+  void updateLayers();
+  void activateTab(int index);
+  void saveSnapshot();
+  void showSnapshot(int index);
+  void hideSnapshot();
+
   Ui::MiniBrowser *ui;
+  NetworkAccessManager *m_network;
   QImage m_img;
   QImage::Format m_format;
-  QImage m_cursor;
   bool m_cursorEnabled;
   QPoint m_mousePos;
   bool m_mouseLeftDown;
   bool m_mouseRightDown;
   bool m_selectDown;
+  QByteArray m_session;
+  QElapsedTimer m_sessionAge;
+  bool m_sessionDirty;
+  bool m_pageLoaded;
+  QList<Tab> m_tabs;
+  int m_currentTab;
+  QElapsedTimer m_tabInput;
+  QElapsedTimer m_snapshotShown;
+  bool m_videoPlaying;
+  QElapsedTimer m_videoCheck;
+  int m_updates;
+  ReplayClock *m_clock;
+  int m_renderScale;
+  QImage m_scaled;
+  QPainter m_scaledPainter;
+  Compositor m_compositor;
+  int m_chromeLayer;
+  int m_pageLayer;
+  int m_overlayLayer;
+  int m_cursorLayer;
+  DamageRects m_pageDamage;
+  DamageRects m_chromeDamage;
+  bool m_compositing;
+  bool m_painted;
+  QPoint m_pageScroll;
+  PageMetrics *m_metrics;
+  ScriptWatchdog m_watchdog;
+  QString m_keyText;
 };
 
 #endif // MINIBROWSER_H
@@ -0,0 +1,855 @@
+#include "networkaccessmanager.h"
+#include <QTimer>
+#include <QThread>
+#include <QBuffer>
+#include <QImageReader>
+#include <QWebPage>
+#include <QWebFrame>
+#include <QWebElement>
+#include <QNetworkCookieJar>
+#include <QHostAddress>
+#include "imagetranscoder.h"
+#include <string.h>
+
+/* Bytes a shared transfer keeps around so that a duplicate GET arriving
+ * mid-download can be replayed from the start. Larger bodies stop being
+ * shared and later duplicates go out on their own. */
+#define NETWORK_REPLAY_LIMIT (2 * 1024 * 1024)
+
+static const char *stylesheet_exts[] = { ".css" };
+static const char *script_exts[] = { ".js" };
+static const char *font_exts[] = { ".woff", ".woff2", ".ttf", ".otf", ".eot" };
+static const char *image_exts[] = { ".png", ".jpg", ".jpeg", ".gif", ".webp", ".svg", ".ico", ".bmp" };
+static const char *media_exts[] = { ".mp4", ".webm", ".ogg", ".ogv", ".oga", ".mp3", ".m4a", ".m3u8", ".ts" };
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+static bool hasExtension(const QString &path, const char **exts, size_t count) {
+  for(size_t i = 0; i < count; i++) {
+    if(path.endsWith(QLatin1String(exts[i])))
+      return true;
+  }
+
+  return false;
+}
+
+/* Public suffixes of two labels under which sites register their names.
+ * The common ones from the public suffix list; a host under one that is
+ * missing is still told apart from hosts of other sites, only not merged
+ * with its own subdomains. */
+static const char *second_level_suffixes[] = {
+  "co.uk", "org.uk", "me.uk", "ltd.uk", "plc.uk", "net.uk", "ac.uk", "gov.uk", "sch.uk", "nhs.uk",
+  "com.au", "net.au", "org.au", "edu.au", "gov.au", "asn.au", "id.au",
+  "co.nz", "net.nz", "org.nz", "ac.nz", "govt.nz",
+  "co.jp", "ne.jp", "or.jp", "ac.jp", "go.jp", "gr.jp",
+  "co.kr", "ne.kr", "or.kr", "ac.kr", "go.kr",
+  "com.cn", "net.cn", "org.cn", "edu.cn", "gov.cn",
+  "com.hk", "org.hk", "com.tw", "org.tw", "com.sg", "com.my",
+  "co.in", "net.in", "org.in", "firm.in", "gen.in", "ac.in",
+  "co.id", "or.id", "ac.id", "com.ph", "com.vn", "co.th", "in.th", "ac.th",
+  "com.br", "net.br", "org.br", "gov.br", "com.ar", "com.mx", "com.co", "com.pe", "com.ve",
+  "co.za", "org.za", "ac.za", "gov.za", "co.ke", "com.ng", "com.eg",
+  "co.il", "org.il", "ac.il", "com.tr", "com.sa", "com.pk", "com.ua", "com.pl",
+};
+
+/* Approximates the registrable domain ("www.example.co.uk" -> "example.co.uk")
+ * well enough to tell first-party from third-party requests. An IP address
+ * is a site of its own. */
+static QString siteOf(const QString &host) {
+  if(QHostAddress(host).protocol() != QAbstractSocket::UnknownNetworkLayerProtocol)
+    return host;
+
+  QStringList labels = host.split('.', QString::SkipEmptyParts);
+  int keep = 2;
+
+  if(labels.size() >= 3) {
+    QString suffix = labels.at(labels.size() - 2) + '.' + labels.last();
+
+    for(size_t i = 0; i < ARRAY_SIZE(second_level_suffixes); i++) {
+      if(suffix.compare(QLatin1String(second_level_suffixes[i]), Qt::CaseInsensitive) == 0) {
+        keep = 3;
+        break;
+      }
+    }
+  }
+
+  while(labels.size() > keep)
+    labels.removeFirst();
+
+  return labels.join('.');
+}
+
+NetworkReplyProxy::NetworkReplyProxy(NetworkAccessManager *manager, QNetworkAccessManager::Operation op, const QNetworkRequest &request) :
+  QNetworkReply(manager)
+  ,m_manager(manager)
+  ,m_buffer()
+  ,m_received(0)
+  ,m_total(-1)
+  ,m_live(false)
+  ,m_metaDataPending(false)
+  ,m_dataPending(false)
+  ,m_finishPending(false)
+{
+  setOperation(op);
+  setRequest(request);
+  setUrl(request.url());
+  open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+
+  // WebKit only connects to our signals after createRequest() returns
+  QMetaObject::invokeMethod(this, "goLive", Qt::QueuedConnection);
+}
+
+NetworkReplyProxy::~NetworkReplyProxy()
+{
+  if(m_manager)
+    m_manager->detach(this);
+}
+
+void NetworkReplyProxy::abort() {
+  if(isFinished())
+    return;
+
+  if(m_manager)
+    m_manager->detach(this);
+
+  m_buffer.clear();
+  finish(OperationCanceledError, tr("Operation canceled"));
+}
+
+qint64 NetworkReplyProxy::bytesAvailable() const {
+  return m_buffer.size() + QNetworkReply::bytesAvailable();
+}
+
+bool NetworkReplyProxy::isSequential() const {
+  return true;
+}
+
+/* Copies status and headers from @source. A non-empty @contentType replaces
+ * the body description when the body was rewritten on the way through. */
+void NetworkReplyProxy::copyMetaData(QNetworkReply *source, const QByteArray &contentType, qint64 contentLength) {
+  static const QNetworkRequest::Attribute attributes[] = {
+    QNetworkRequest::HttpStatusCodeAttribute,
+    QNetworkRequest::HttpReasonPhraseAttribute,
+    QNetworkRequest::RedirectionTargetAttribute,
+    QNetworkRequest::ConnectionEncryptedAttribute,
+    QNetworkRequest::SourceIsFromCacheAttribute
+  };
+
+  foreach(const QNetworkReply::RawHeaderPair &pair, source->rawHeaderPairs())
+    setRawHeader(pair.first, pair.second);
+
+  for(size_t i = 0; i < ARRAY_SIZE(attributes); i++) {
+    QVariant value = source->attribute(attributes[i]);
+
+    if(value.isValid())
+      setAttribute(attributes[i], value);
+  }
+
+  if(!contentType.isEmpty()) {
+    setRawHeader("Content-Type", contentType);
+    setRawHeader("Content-Length", QByteArray::number(contentLength));
+  }
+
+  m_metaDataPending = true;
+  emitPending();
+}
+
+void NetworkReplyProxy::appendData(const QByteArray &data, qint64 total) {
+  m_buffer.append(data);
+  m_received += data.size();
+  m_total = total;
+  m_dataPending = true;
+  emitPending();
+}
+
+void NetworkReplyProxy::finish(QNetworkReply::NetworkError code, const QString &errorString) {
+  if(isFinished() || m_finishPending)
+    return;
+
+  if(code != NoError)
+    setError(code, errorString);
+
+  m_finishPending = true;
+  emitPending();
+}
+
+qint64 NetworkReplyProxy::readData(char *data, qint64 maxSize) {
+  qint64 len = qMin(maxSize, (qint64)m_buffer.size());
+
+  if(len == 0)
+    return isFinished() ? -1 : 0;
+
+  memcpy(data, m_buffer.constData(), len);
+  m_buffer.remove(0, len);
+
+  return len;
+}
+
+void NetworkReplyProxy::goLive() {
+  m_live = true;
+  emitPending();
+}
+
+void NetworkReplyProxy::emitPending() {
+  if(!m_live)
+    return;
+
+  if(m_metaDataPending) {
+    m_metaDataPending = false;
+    emit metaDataChanged();
+  }
+
+  if(m_dataPending) {
+    m_dataPending = false;
+    emit readyRead();
+    emit downloadProgress(m_received, m_total);
+  }
+
+  if(m_finishPending) {
+    m_finishPending = false;
+
+    if(error() != NoError)
+      emit error(error());
+
+    setFinished(true);
+    emit finished();
+  }
+}
+
+NetworkAccessManager::NetworkAccessManager(QObject *parent) :
+  QNetworkAccessManager(parent)
+  ,m_page()
+  ,m_blocker()
+  ,m_deferTimer(new QTimer(this))
+  ,m_active(0)
+  ,m_maxPerHost(6)
+  ,m_max(16)
+  ,m_lookahead(1000)
+  ,m_maxDeferral(10000)
+  ,m_laidOut(false)
+  ,m_imageMapDirty(true)
+  ,m_lastScroll()
+  ,m_maxImageSize()
+  ,m_fontsEnabled(true)
+  ,m_transcodePool()
+  ,m_nextTranscodeId(0)
+{
+  m_deferTimer->setSingleShot(true);
+  // leave a core for the frame thread
+  m_transcodePool.setMaxThreadCount(qMax(1, QThread::idealThreadCount() - 1));
+
+  connect(m_deferTimer, SIGNAL(timeout()), this, SLOT(pump()));
+}
+
+NetworkAccessManager::~NetworkAccessManager()
+{
+  QHash<QNetworkReply*, Transfer*>::iterator it;
+
+  m_transcodePool.waitForDone();
+
+  for(it = m_replies.begin(); it != m_replies.end(); ++it) {
+    it.key()->disconnect(this);
+    it.key()->abort();
+    delete it.value();
+  }
+
+  qDeleteAll(m_queue);
+  qDeleteAll(m_transcoding);
+}
+
+void NetworkAccessManager::setPage(QWebPage *page) {
+  if(m_page == page)
+    return;
+
+  if(m_page) {
+    disconnect(m_page, 0, this, 0);
+    disconnect(m_page->mainFrame(), 0, this, 0);
+  }
+
+  m_page = page;
+
+  // a page switched to from another tab may have been laid out long ago
+  m_laidOut = !page->mainFrame()->contentsSize().isEmpty();
+  m_imageMapDirty = true;
+
+  connect(page, SIGNAL(loadStarted()), this, SLOT(onLoadStarted()));
+  connect(page->mainFrame(), SIGNAL(initialLayoutCompleted()), this, SLOT(onLayoutChanged()));
+  connect(page->mainFrame(), SIGNAL(contentsSizeChanged(QSize)), this, SLOT(onLayoutChanged()));
+
+  // what the tab switched away from waits behind what this one needs
+  requeue();
+  pump();
+}
+
+void NetworkAccessManager::setMaxRequestsPerHost(int max) {
+  m_maxPerHost = qMax(1, max);
+  pump();
+}
+
+void NetworkAccessManager::setMaxRequests(int max) {
+  m_max = qMax(1, max);
+  pump();
+}
+
+void NetworkAccessManager::setLookahead(int pixels) {
+  m_lookahead = qMax(0, pixels);
+  pump();
+}
+
+void NetworkAccessManager::setMaxDeferral(int msec) {
+  m_maxDeferral = msec;
+  pump();
+}
+
+/* Images decoding to more than @size are scaled down to fit it before WebKit
+ * sees them. An invalid size turns the stage off. */
+void NetworkAccessManager::setMaxImageSize(const QSize &size) {
+  m_maxImageSize = size;
+}
+
+void NetworkAccessManager::setFontsEnabled(bool on) {
+  m_fontsEnabled = on;
+}
+
+/* Takes over the other manager's cookies and content filters. The compiled
+ * filter tables are implicitly shared, so another view costs no memory for
+ * them until one side loads new lists. */
+void NetworkAccessManager::shareWith(NetworkAccessManager *other) {
+  QNetworkCookieJar *jar = other->cookieJar();
+
+  setCookieJar(jar);
+  // setCookieJar() reparents the jar; it stays with the manager it came from
+  jar->setParent(other);
+
+  m_blocker = other->m_blocker;
+}
+
+/* Called once per frame. Only does work when images are being held back and
+ * the page has scrolled far enough to possibly bring some of them near. */
+void NetworkAccessManager::updateViewport() {
+  if(!m_page || m_queue.isEmpty())
+    return;
+
+  QPoint scroll = m_page->mainFrame()->scrollPosition();
+
+  if((scroll - m_lastScroll).manhattanLength() < m_lookahead / 4)
+    return;
+
+  m_lastScroll = scroll;
+  pump();
+}
+
+ContentBlocker* NetworkAccessManager::contentBlocker() {
+  return &m_blocker;
+}
+
+NetworkAccessManager::RequestClass NetworkAccessManager::classify(const QNetworkRequest &request) {
+  QByteArray accept = request.rawHeader("Accept");
+  QString path = request.url().path().toLower();
+
+  // WebKit's GStreamer source asks every stream for Shoutcast metadata
+  if(request.hasRawHeader("Range") || request.hasRawHeader("icy-metadata") || hasExtension(path, media_exts, ARRAY_SIZE(media_exts)))
+    return ClassMedia;
+
+  if(accept.startsWith("text/html"))
+    return ClassDocument;
+
+  if(accept.startsWith("text/css") || hasExtension(path, stylesheet_exts, ARRAY_SIZE(stylesheet_exts)))
+    return ClassStylesheet;
+
+  if(accept.startsWith("image/") || hasExtension(path, image_exts, ARRAY_SIZE(image_exts)))
+    return ClassImage;
+
+  if(hasExtension(path, script_exts, ARRAY_SIZE(script_exts)))
+    return ClassScript;
+
+  if(hasExtension(path, font_exts, ARRAY_SIZE(font_exts)))
+    return ClassFont;
+
+  return ClassOther;
+}
+
+/* Bodies held in memory: what is kept to hand to late duplicates or to
+ * transcode, and what proxies have not passed on to WebKit yet. */
+qint64 NetworkAccessManager::bufferedBytes() const {
+  QList<Transfer*> transfers = m_replies.values() + m_transcoding.values();
+  qint64 bytes = 0;
+
+  foreach(Transfer *transfer, transfers) {
+    bytes += transfer->received.size();
+
+    foreach(const QPointer<NetworkReplyProxy> &proxy, transfer->proxies) {
+      if(proxy)
+        bytes += proxy->bytesAvailable();
+    }
+  }
+
+  return bytes;
+}
+
+/* Every reply WebKit gets is announced, whichever way it was made. */
+QNetworkReply* NetworkAccessManager::createRequest(Operation op, const QNetworkRequest &request, QIODevice *outgoingData) {
+  QNetworkReply *reply = createReply(op, request, outgoingData);
+
+  emit replyCreated(reply);
+  return reply;
+}
+
+QNetworkReply* NetworkAccessManager::createReply(Operation op, const QNetworkRequest &request, QIODevice *outgoingData) {
+  if(!request.url().scheme().startsWith("http"))
+    return QNetworkAccessManager::createRequest(op, request, outgoingData);
+
+  RequestClass cls = classify(request);
+
+  if(isBlocked(request, cls)) {
+    NetworkReplyProxy *blocked = new NetworkReplyProxy(this, op, request);
+
+    blocked->finish(QNetworkReply::ContentAccessDenied, tr("Blocked by content filter"));
+    return blocked;
+  }
+
+  if(cls == ClassMedia)
+    emit mediaRequested();
+
+  // WebKit falls back to the fonts named after the web font in the stylesheet
+  if(cls == ClassFont && !m_fontsEnabled) {
+    NetworkReplyProxy *blocked = new NetworkReplyProxy(this, op, request);
+
+    blocked->finish(QNetworkReply::ContentAccessDenied, tr("Web fonts are disabled"));
+    return blocked;
+  }
+
+  if(op != GetOperation || outgoingData)
+    return QNetworkAccessManager::createRequest(op, request, outgoingData);
+
+  // documents are the critical path and media needs ranged, unbuffered access
+  if(cls == ClassDocument || cls == ClassMedia)
+    return QNetworkAccessManager::createRequest(op, request, outgoingData);
+
+  NetworkReplyProxy *proxy = new NetworkReplyProxy(this, op, request);
+  QWebFrame *frame = qobject_cast<QWebFrame*>(request.originatingObject());
+  QWebPage *page = frame ? frame->page() : 0;
+  QString key = request.url().toString();
+  // XHRs and the like may differ in Accept or Authorization; only static subresources are shared
+  bool shareable = cls == ClassImage || cls == ClassStylesheet || cls == ClassScript || cls == ClassFont;
+  Transfer *transfer = shareable ? m_inFlight.value(key) : 0;
+
+  if(transfer) {
+    transfer->proxies.append(proxy);
+
+    // queued for a background tab, but now the shown one needs it too
+    if(!transfer->reply && isBackground(transfer) && page == m_page) {
+      transfer->page = page;
+      m_queue.removeAll(transfer);
+      enqueue(transfer);
+      pump();
+    }
+
+    // a transcoded body is handed out to everyone at once when it is ready
+    if(transfer->transcode)
+      return proxy;
+
+    if(transfer->hasMetaData)
+      proxy->copyMetaData(transfer->reply);
+
+    if(!transfer->received.isEmpty())
+      proxy->appendData(transfer->received, transfer->reply->header(QNetworkRequest::ContentLengthHeader).toLongLong());
+
+    return proxy;
+  }
+
+  transfer = new Transfer;
+  transfer->request = request;
+  transfer->key = key;
+  transfer->host = request.url().host();
+  transfer->cls = cls;
+  transfer->page = page;
+  // third-party work of any kind sorts after all first-party work
+  transfer->priority = cls + (isThirdParty(request) ? ClassMedia : 0);
+  transfer->deferred = false;
+  transfer->queued.start();
+  transfer->reply = 0;
+  transfer->active = false;
+  transfer->transcode = cls == ClassImage && m_maxImageSize.isValid();
+  transfer->transcodeId = -1;
+  transfer->replayable = shareable;
+  transfer->hasMetaData = false;
+  transfer->proxies.append(proxy);
+
+  if(shareable)
+    m_inFlight.insert(key, transfer);
+
+  enqueue(transfer);
+  pump();
+
+  return proxy;
+}
+
+void NetworkAccessManager::enqueue(Transfer *transfer) {
+  int i = m_queue.size();
+
+  while(i > 0 && rank(m_queue.at(i - 1)) > rank(transfer))
+    i--;
+
+  m_queue.insert(i, transfer);
+}
+
+/* Sorts the queue again after the shown page changed. */
+void NetworkAccessManager::requeue() {
+  QList<Transfer*> queued = m_queue;
+
+  m_queue.clear();
+
+  foreach(Transfer *transfer, queued)
+    enqueue(transfer);
+}
+
+/* Work for a tab in the background sorts after all work for the shown one. */
+int NetworkAccessManager::rank(const Transfer *transfer) const {
+  return transfer->priority + (isBackground(transfer) ? 2 * ClassMedia + 1 : 0);
+}
+
+bool NetworkAccessManager::isBackground(const Transfer *transfer) const {
+  return transfer->page && transfer->page != m_page;
+}
+
+void NetworkAccessManager::pump() {
+  bool holding = false;
+  int i = 0;
+
+  while(i < m_queue.size() && m_active < m_max) {
+    Transfer *transfer = m_queue.at(i);
+
+    if(transfer->cls == ClassImage) {
+      // the image geometry known is the shown page's, so a background tab's images wait
+      transfer->deferred = isBackground(transfer) || !isNearViewport(transfer->request.url());
+
+      // a non-positive deferral limit holds offscreen images until scrolled to or shown
+      if(transfer->deferred && (m_maxDeferral <= 0 || transfer->queued.elapsed() < m_maxDeferral)) {
+        holding = true;
+        i++;
+        continue;
+      }
+    }
+
+    if(m_activePerHost.value(transfer->host) >= m_maxPerHost) {
+      i++;
+      continue;
+    }
+
+    m_queue.removeAt(i);
+    start(transfer);
+  }
+
+  if(holding && m_maxDeferral > 0 && !m_deferTimer->isActive())
+    m_deferTimer->start(qMin(500, m_maxDeferral));
+}
+
+void NetworkAccessManager::start(Transfer *transfer) {
+  QNetworkReply *reply = QNetworkAccessManager::createRequest(GetOperation, transfer->request, 0);
+
+  transfer->reply = reply;
+  transfer->active = true;
+  m_replies.insert(reply, transfer);
+  m_activePerHost[transfer->host]++;
+  m_active++;
+
+  connect(reply, SIGNAL(metaDataChanged()), this, SLOT(onMetaDataChanged()));
+  connect(reply, SIGNAL(readyRead()), this, SLOT(onReadyRead()));
+  connect(reply, SIGNAL(finished()), this, SLOT(onFinished()));
+}
+
+/* Gives back the connection slot of a transfer whose download is over. */
+void NetworkAccessManager::retire(Transfer *transfer) {
+  if(!transfer->active)
+    return;
+
+  transfer->active = false;
+  m_replies.remove(transfer->reply);
+  m_active--;
+
+  if(--m_activePerHost[transfer->host] <= 0)
+    m_activePerHost.remove(transfer->host);
+}
+
+void NetworkAccessManager::release(Transfer *transfer) {
+  retire(transfer);
+
+  if(m_inFlight.value(transfer->key) == transfer)
+    m_inFlight.remove(transfer->key);
+
+  if(transfer->transcodeId >= 0)
+    m_transcoding.remove(transfer->transcodeId);
+
+  if(transfer->reply)
+    transfer->reply->deleteLater();
+
+  delete transfer;
+}
+
+void NetworkAccessManager::detach(NetworkReplyProxy *proxy) {
+  QList<Transfer*> candidates = m_queue + m_replies.values() + m_transcoding.values();
+
+  foreach(Transfer *transfer, candidates) {
+    if(!transfer->proxies.removeAll(QPointer<NetworkReplyProxy>(proxy)))
+      continue;
+
+    transfer->proxies.removeAll(QPointer<NetworkReplyProxy>());
+
+    if(!transfer->proxies.isEmpty())
+      return;
+
+    if(transfer->reply) {
+      transfer->reply->disconnect(this);
+      transfer->reply->abort();
+    }else{
+      m_queue.removeAll(transfer);
+    }
+
+    release(transfer);
+    pump();
+    return;
+  }
+}
+
+void NetworkAccessManager::onMetaDataChanged() {
+  QNetworkReply *reply = qobject_cast<QNetworkReply*>(sender());
+  Transfer *transfer = m_replies.value(reply);
+
+  if(!transfer)
+    return;
+
+  transfer->hasMetaData = true;
+
+  if(transfer->transcode)
+    return;
+
+  foreach(const QPointer<NetworkReplyProxy> &proxy, transfer->proxies) {
+    if(proxy)
+      proxy->copyMetaData(reply);
+  }
+}
+
+void NetworkAccessManager::onReadyRead() {
+  QNetworkReply *reply = qobject_cast<QNetworkReply*>(sender());
+  Transfer *transfer = m_replies.value(reply);
+
+  if(!transfer)
+    return;
+
+  QByteArray data = reply->readAll();
+  QVariant length = reply->header(QNetworkRequest::ContentLengthHeader);
+  qint64 total = length.isValid() ? length.toLongLong() : -1;
+
+  // held back whole until we know whether it needs scaling down
+  if(transfer->transcode) {
+    transfer->received.append(data);
+    return;
+  }
+
+  if(transfer->replayable) {
+    if(transfer->received.size() + data.size() > NETWORK_REPLAY_LIMIT) {
+      transfer->replayable = false;
+      transfer->received.clear();
+
+      if(m_inFlight.value(transfer->key) == transfer)
+        m_inFlight.remove(transfer->key);
+    }else{
+      transfer->received.append(data);
+    }
+  }
+
+  foreach(const QPointer<NetworkReplyProxy> &proxy, transfer->proxies) {
+    if(proxy)
+      proxy->appendData(data, total);
+  }
+}
+
+void NetworkAccessManager::onFinished() {
+  QNetworkReply *reply = qobject_cast<QNetworkReply*>(sender());
+  Transfer *transfer = m_replies.value(reply);
+
+  if(!transfer)
+    return;
+
+  if(reply->bytesAvailable() > 0) {
+    onReadyRead();
+
+    // the last proxy may have aborted while reading
+    if(!m_replies.contains(reply))
+      return;
+  }
+
+  // proxies may abort from inside finished(); keep detach() away from us
+  retire(transfer);
+
+  if(transfer->transcode) {
+    if(reply->error() == QNetworkReply::NoError && startTranscode(transfer)) {
+      pump();
+      return;
+    }
+
+    deliver(transfer, transfer->received, QByteArray());
+  }else{
+    foreach(const QPointer<NetworkReplyProxy> &proxy, transfer->proxies) {
+      if(proxy)
+        proxy->finish(reply->error(), reply->errorString());
+    }
+  }
+
+  release(transfer);
+  pump();
+}
+
+/* Hands a complete body to every proxy of a transfer that was held back. */
+void NetworkAccessManager::deliver(Transfer *transfer, const QByteArray &body, const QByteArray &contentType) {
+  QNetworkReply *reply = transfer->reply;
+
+  foreach(const QPointer<NetworkReplyProxy> &proxy, transfer->proxies) {
+    if(!proxy)
+      continue;
+
+    if(transfer->hasMetaData)
+      proxy->copyMetaData(reply, contentType, body.size());
+
+    if(!body.isEmpty())
+      proxy->appendData(body, body.size());
+
+    if(proxy)
+      proxy->finish(reply->error(), reply->errorString());
+  }
+}
+
+/* Only the image header is parsed here; decoding and re-encoding happen on
+ * the transcode pool. Returns false if the image can go out as it is. */
+bool NetworkAccessManager::startTranscode(Transfer *transfer) {
+  if(transfer->received.isEmpty() || transfer->reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() != 200)
+    return false;
+
+  QBuffer buffer(&transfer->received);
+  QImageReader reader(&buffer);
+  QSize size = reader.size();
+
+  if(!size.isValid() || reader.supportsAnimation())
+    return false;
+
+  if(size.width() <= m_maxImageSize.width() && size.height() <= m_maxImageSize.height())
+    return false;
+
+  ImageTranscoder *task = new ImageTranscoder(m_nextTranscodeId, transfer->received, size.scaled(m_maxImageSize, Qt::KeepAspectRatio), this);
+
+  transfer->transcodeId = m_nextTranscodeId;
+  m_transcoding.insert(transfer->transcodeId, transfer);
+  m_nextTranscodeId = (m_nextTranscodeId + 1) & 0x7fffffff;
+
+  connect(task, SIGNAL(done(int,QByteArray,QByteArray)), this, SLOT(onTranscoded(int,QByteArray,QByteArray)));
+  m_transcodePool.start(task);
+
+  return true;
+}
+
+void NetworkAccessManager::onTranscoded(int id, const QByteArray &data, const QByteArray &contentType) {
+  Transfer *transfer = m_transcoding.take(id);
+
+  sender()->deleteLater();
+
+  // every proxy went away while we were busy
+  if(!transfer)
+    return;
+
+  transfer->transcodeId = -1;
+
+  if(data.isEmpty())
+    deliver(transfer, transfer->received, QByteArray());
+  else
+    deliver(transfer, data, contentType);
+
+  release(transfer);
+}
+
+void NetworkAccessManager::onLoadStarted() {
+  m_laidOut = false;
+  m_imageMapDirty = true;
+}
+
+void NetworkAccessManager::onLayoutChanged() {
+  m_laidOut = true;
+  m_imageMapDirty = true;
+  pump();
+}
+
+bool NetworkAccessManager::isThirdParty(const QNetworkRequest &request) const {
+  QWebFrame *frame = qobject_cast<QWebFrame*>(request.originatingObject());
+
+  if(!frame)
+    return false;
+
+  return siteOf(frame->url().host()) != siteOf(request.url().host());
+}
+
+bool NetworkAccessManager::isBlocked(const QNetworkRequest &request, RequestClass cls) const {
+  // the main frame's document is let through below, so any other is a subframe's
+  static const int types[] = {
+    ContentBlocker::TypeSubdocument,
+    ContentBlocker::TypeStylesheet,
+    ContentBlocker::TypeScript,
+    ContentBlocker::TypeFont,
+    ContentBlocker::TypeImage,
+    ContentBlocker::TypeOther,
+    ContentBlocker::TypeMedia
+  };
+
+  if(m_blocker.isEmpty())
+    return false;
+
+  // never block the page itself, only what it pulls in
+  if(cls == ClassDocument && m_page && request.originatingObject() == m_page->mainFrame())
+    return false;
+
+  return m_blocker.shouldBlock(request.url().toEncoded().toLower(), request.url().host().toLower().toUtf8(), types[cls], isThirdParty(request));
+}
+
+bool NetworkAccessManager::isNearViewport(const QUrl &url) {
+  if(!m_page)
+    return true;
+
+  // nothing has a position before the first layout, so hold images until then
+  if(!m_laidOut)
+    return false;
+
+  if(m_imageMapDirty)
+    rebuildImageMap();
+
+  QHash<QString, QRect>::const_iterator it = m_imageRects.constFind(url.toString());
+
+  // CSS backgrounds, srcset candidates and subframe images can't be placed
+  if(it == m_imageRects.constEnd() || it->isNull())
+    return true;
+
+  QWebFrame *frame = m_page->mainFrame();
+  QRect view(frame->scrollPosition(), m_page->viewportSize());
+
+  view.adjust(-m_lookahead, -m_lookahead, m_lookahead, m_lookahead);
+
+  return view.intersects(*it);
+}
+
+void NetworkAccessManager::rebuildImageMap() {
+  QWebFrame *frame = m_page->mainFrame();
+  QUrl base = frame->baseUrl();
+
+  m_imageRects.clear();
+  m_imageMapDirty = false;
+
+  foreach(const QWebElement &img, frame->findAllElements("img[src]")) {
+    QString url = base.resolved(QUrl(img.attribute("src"))).toString();
+    QRect rect = img.geometry();
+    QHash<QString, QRect>::iterator it = m_imageRects.find(url);
+
+    // the same image used in several places is as near as its nearest use
+    if(it == m_imageRects.end())
+      m_imageRects.insert(url, rect);
+    else
+      *it = it->united(rect);
+  }
+}
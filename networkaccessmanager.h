@@ -0,0 +1,168 @@
+#ifndef NETWORKACCESSMANAGER_H
+#define NETWORKACCESSMANAGER_H
+
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QElapsedTimer>
+#include <QPointer>
+#include <QHash>
+#include <QList>
+#include <QRect>
+#include <QSize>
+#include <QThreadPool>
+#include "contentblocker.h"
+
+class QTimer;
+class QWebPage;
+class QWebFrame;
+class NetworkAccessManager;
+
+/* What WebKit sees for every request that goes through the scheduler. The
+ * real QNetworkReply is owned by the manager and may be shared by several
+ * proxies when identical GETs for images, stylesheets, scripts or fonts
+ * are deduplicated. */
+class NetworkReplyProxy : public QNetworkReply
+{
+  Q_OBJECT
+
+public:
+  NetworkReplyProxy(NetworkAccessManager *manager, QNetworkAccessManager::Operation op, const QNetworkRequest &request);
+  ~NetworkReplyProxy();
+
+  void abort();
+  qint64 bytesAvailable() const;
+  bool isSequential() const;
+
+  void copyMetaData(QNetworkReply *source, const QByteArray &contentType = QByteArray(), qint64 contentLength = -1);
+  void appendData(const QByteArray &data, qint64 total);
+  void finish(QNetworkReply::NetworkError code, const QString &errorString);
+
+protected:
+  qint64 readData(char *data, qint64 maxSize);
+
+private slots:
+  void goLive();
+
+private:
+  void emitPending();
+
+  QPointer<NetworkAccessManager> m_manager;
+  QByteArray m_buffer;
+  qint64 m_received;
+  qint64 m_total;
+  bool m_live;
+  bool m_metaDataPending;
+  bool m_dataPending;
+  bool m_finishPending;
+};
+
+class NetworkAccessManager : public QNetworkAccessManager
+{
+  Q_OBJECT
+
+public:
+  enum RequestClass {
+    ClassDocument,
+    ClassStylesheet,
+    ClassScript,
+    ClassFont,
+    ClassImage,
+    ClassOther,
+    ClassMedia
+  };
+
+  explicit NetworkAccessManager(QObject *parent = 0);
+  ~NetworkAccessManager();
+
+  void setPage(QWebPage *page);
+  void setMaxRequestsPerHost(int max);
+  void setMaxRequests(int max);
+  void setLookahead(int pixels);
+  void setMaxDeferral(int msec);
+  void setMaxImageSize(const QSize &size);
+  void setFontsEnabled(bool on);
+  void updateViewport();
+  void shareWith(NetworkAccessManager *other);
+  ContentBlocker* contentBlocker();
+  qint64 bufferedBytes() const;
+
+  static RequestClass classify(const QNetworkRequest &request);
+
+signals:
+  void replyCreated(QNetworkReply *reply);
+  void mediaRequested();
+
+protected:
+  QNetworkReply* createRequest(Operation op, const QNetworkRequest &request, QIODevice *outgoingData = 0);
+
+private slots:
+  void onMetaDataChanged();
+  void onReadyRead();
+  void onFinished();
+  void onLoadStarted();
+  void onLayoutChanged();
+  void onTranscoded(int id, const QByteArray &data, const QByteArray &contentType);
+  void pump();
+
+private:
+  struct Transfer {
+    QNetworkRequest request;
+    QString key;
+    QString host;
+    RequestClass cls;
+    QPointer<QWebPage> page;
+    int priority;
+    bool deferred;
+    QElapsedTimer queued;
+    QNetworkReply *reply;
+    bool active;
+    bool transcode;
+    int transcodeId;
+    QByteArray received;
+    bool replayable;
+    bool hasMetaData;
+    QList<QPointer<NetworkReplyProxy> > proxies;
+  };
+
+  friend class NetworkReplyProxy;
+
+  QNetworkReply* createReply(Operation op, const QNetworkRequest &request, QIODevice *outgoingData);
+  void detach(NetworkReplyProxy *proxy);
+  void enqueue(Transfer *transfer);
+  void requeue();
+  int rank(const Transfer *transfer) const;
+  bool isBackground(const Transfer *transfer) const;
+  void start(Transfer *transfer);
+  void retire(Transfer *transfer);
+  void release(Transfer *transfer);
+  void deliver(Transfer *transfer, const QByteArray &body, const QByteArray &contentType);
+  bool startTranscode(Transfer *transfer);
+  bool isThirdParty(const QNetworkRequest &request) const;
+  bool isBlocked(const QNetworkRequest &request, RequestClass cls) const;
+  bool isNearViewport(const QUrl &url);
+  void rebuildImageMap();
+
+  QPointer<QWebPage> m_page;
+  ContentBlocker m_blocker;
+  QTimer *m_deferTimer;
+  QList<Transfer*> m_queue;
+  QHash<QString, Transfer*> m_inFlight;
+  QHash<QNetworkReply*, Transfer*> m_replies;
+  QHash<QString, int> m_activePerHost;
+  QHash<QString, QRect> m_imageRects;
+  QHash<int, Transfer*> m_transcoding;
+  int m_active;
+  int m_maxPerHost;
+  int m_max;
+  int m_lookahead;
+  int m_maxDeferral;
+  bool m_laidOut;
+  bool m_imageMapDirty;
+  QPoint m_lastScroll;
+  QSize m_maxImageSize;
+  bool m_fontsEnabled;
+  QThreadPool m_transcodePool;
+  int m_nextTranscodeId;
+};
+
+#endif // NETWORKACCESSMANAGER_H
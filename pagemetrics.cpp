@@ -0,0 +1,182 @@
+#include "pagemetrics.h"
+#include "networkaccessmanager.h"
+#include <QDateTime>
+#include <QFile>
+#include <QTextStream>
+#include <QVariantList>
+#include <QWebPage>
+#include <QWebFrame>
+
+static const char timing_script[] =
+  "(function() {"
+  "  var t = window.performance && window.performance.timing;"
+  "  if(!t) return null;"
+  "  return [t.navigationStart, t.responseStart, t.domContentLoadedEventStart, t.loadEventStart];"
+  "})()";
+
+PageMetrics::PageMetrics(QObject *parent) :
+  QObject(parent)
+  ,m_page()
+  ,m_path()
+  ,m_active(false)
+  ,m_start()
+  ,m_commit(-1)
+  ,m_firstPaint(-1)
+  ,m_requests(0)
+  ,m_bytes(0)
+  ,m_layouts(0)
+  ,m_repaints(0)
+  ,m_replyBytes()
+{
+}
+
+/* A load that is underway when its tab goes to the background is dropped;
+ * hidden pages are throttled and would only skew the numbers. */
+void PageMetrics::setPage(QWebPage *page) {
+  if(m_page == page)
+    return;
+
+  if(m_page) {
+    disconnect(m_page, 0, this, 0);
+    disconnect(m_page->mainFrame(), 0, this, 0);
+  }
+
+  m_page = page;
+  m_active = false;
+  m_replyBytes.clear();
+
+  if(!m_page)
+    return;
+
+  connect(page, SIGNAL(loadStarted()), this, SLOT(onLoadStarted()));
+  connect(page, SIGNAL(loadFinished(bool)), this, SLOT(onLoadFinished(bool)));
+  connect(page->mainFrame(), SIGNAL(urlChanged(QUrl)), this, SLOT(onCommitted()));
+  connect(page->mainFrame(), SIGNAL(contentsSizeChanged(QSize)), this, SLOT(onLayout()));
+}
+
+/* An empty path turns the metrics off. */
+void PageMetrics::setOutput(const QString &path) {
+  m_path = path;
+
+  if(m_path.isEmpty())
+    m_active = false;
+}
+
+/* Called for every repaint of the window showing the page. */
+void PageMetrics::repainted() {
+  if(!m_active)
+    return;
+
+  m_repaints++;
+
+  if(m_commit >= 0 && m_firstPaint < 0)
+    m_firstPaint = m_start.elapsed();
+}
+
+void PageMetrics::onLoadStarted() {
+  if(m_path.isEmpty())
+    return;
+
+  m_active = true;
+  m_start.start();
+  m_commit = -1;
+  m_firstPaint = -1;
+  m_requests = 0;
+  m_bytes = 0;
+  m_layouts = 0;
+  m_repaints = 0;
+  m_replyBytes.clear();
+}
+
+void PageMetrics::onCommitted() {
+  if(m_active && m_commit < 0)
+    m_commit = m_start.elapsed();
+}
+
+void PageMetrics::onLayout() {
+  if(m_active)
+    m_layouts++;
+}
+
+/* Counts what the page loads besides its main document. */
+void PageMetrics::onReplyCreated(QNetworkReply *reply) {
+  QWebFrame *frame = qobject_cast<QWebFrame*>(reply->request().originatingObject());
+
+  if(!m_active || !frame || frame->page() != m_page)
+    return;
+
+  if(frame == m_page->mainFrame() && NetworkAccessManager::classify(reply->request()) == NetworkAccessManager::ClassDocument)
+    return;
+
+  m_requests++;
+  m_replyBytes.insert(reply, 0);
+
+  connect(reply, SIGNAL(downloadProgress(qint64, qint64)), this, SLOT(onReplyProgress(qint64, qint64)));
+  connect(reply, SIGNAL(finished()), this, SLOT(onReplyFinished()));
+}
+
+void PageMetrics::onReplyProgress(qint64 received, qint64) {
+  QHash<QObject*, qint64>::iterator it = m_replyBytes.find(sender());
+
+  if(it == m_replyBytes.end())
+    return;
+
+  m_bytes += received - it.value();
+  it.value() = received;
+}
+
+void PageMetrics::onReplyFinished() {
+  m_replyBytes.remove(sender());
+  sender()->disconnect(this);
+}
+
+void PageMetrics::onLoadFinished(bool ok) {
+  if(!m_active)
+    return;
+
+  m_active = false;
+  write(ok);
+}
+
+void PageMetrics::write(bool ok) {
+  QVariantList timing = m_page->mainFrame()->evaluateJavaScript(timing_script).toList();
+  qint64 ttfb = -1;
+  qint64 domContentLoaded = -1;
+  qint64 load = m_start.elapsed();
+  QFile file(m_path);
+
+  // the API reports milestones that never happened as 0; they are written as -1
+  if(timing.size() == 4 && timing[0].toLongLong() > 0) {
+    qint64 navigationStart = timing[0].toLongLong();
+
+    if(timing[1].toLongLong() > 0)
+      ttfb = timing[1].toLongLong() - navigationStart;
+    if(timing[2].toLongLong() > 0)
+      domContentLoaded = timing[2].toLongLong() - navigationStart;
+    if(timing[3].toLongLong() > 0)
+      load = timing[3].toLongLong() - navigationStart;
+  }
+
+  if(!file.open(QIODevice::WriteOnly | QIODevice::Append))
+    return;
+
+  QTextStream out(&file);
+
+  if(file.size() == 0)
+    out << "time,url,ok,ttfb_ms,dom_content_loaded_ms,load_ms,commit_ms,first_paint_ms,"
+           "subresources,subresource_bytes,layouts,repaints\n";
+
+  // encoded URLs may hold commas but never a double quote
+  out << QDateTime::currentDateTimeUtc().toString(Qt::ISODate) << ','
+      << '"' << m_page->mainFrame()->url().toEncoded() << "\","
+      << (ok ? 1 : 0) << ','
+      << ttfb << ','
+      << domContentLoaded << ','
+      << load << ','
+      << m_commit << ','
+      << m_firstPaint << ','
+      << m_requests << ','
+      << m_bytes << ','
+      << m_layouts << ','
+      << m_repaints << '\n';
+}
@@ -0,0 +1,57 @@
+#ifndef PAGEMETRICS_H
+#define PAGEMETRICS_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QPointer>
+#include <QString>
+#include <QUrl>
+
+class QWebPage;
+class QNetworkReply;
+
+/* Times every navigation of the page it follows and appends one CSV line
+ * per finished load. Load milestones come from the Navigation Timing API,
+ * commit and first paint from the frame's signals and the window's own
+ * repaints, and subresources from the replies the network manager hands
+ * out for the page. All times are milliseconds from the start of the load. */
+class PageMetrics : public QObject
+{
+  Q_OBJECT
+
+public:
+  explicit PageMetrics(QObject *parent = 0);
+
+  void setPage(QWebPage *page);
+  void setOutput(const QString &path);
+  void repainted();
+
+public slots:
+  void onReplyCreated(QNetworkReply *reply);
+
+private slots:
+  void onLoadStarted();
+  void onCommitted();
+  void onLayout();
+  void onLoadFinished(bool ok);
+  void onReplyProgress(qint64 received, qint64 total);
+  void onReplyFinished();
+
+private:
+  void write(bool ok);
+
+  QPointer<QWebPage> m_page;
+  QString m_path;
+  bool m_active;
+  QElapsedTimer m_start;
+  qint64 m_commit;
+  qint64 m_firstPaint;
+  int m_requests;
+  qint64 m_bytes;
+  int m_layouts;
+  int m_repaints;
+  QHash<QObject*, qint64> m_replyBytes;
+};
+
+#endif // PAGEMETRICS_H
@@ -0,0 +1,133 @@
+#include "pagestate.h"
+#include <QDataStream>
+#include <QJsonDocument>
+#include <QWebPage>
+#include <QWebFrame>
+#include <QWebHistory>
+
+#define PAGE_STATE_MAGIC 0x4d425053 /* "MBPS" */
+#define PAGE_STATE_VERSION 2
+
+/* Collects [index, value] for every form field the user changed. Password,
+ * hidden and file inputs are never saved. */
+static const char save_form_js[] =
+  "(function() {"
+  "  var r = [], f = document.querySelectorAll('input, textarea, select');"
+  "  for (var i = 0; i < f.length; i++) {"
+  "    var e = f[i], t = e.type;"
+  "    if (t == 'password' || t == 'hidden' || t == 'file') continue;"
+  "    if (t == 'checkbox' || t == 'radio') {"
+  "      if (e.checked != e.defaultChecked) r.push([i, e.checked ? '1' : '0']);"
+  "    } else if (e.tagName == 'SELECT' || e.value != e.defaultValue) {"
+  "      r.push([i, e.value]);"
+  "    }"
+  "  }"
+  "  return r;"
+  "})()";
+
+static const char restore_form_js[] =
+  "(function(s) {"
+  "  var f = document.querySelectorAll('input, textarea, select');"
+  "  for (var i = 0; i < s.length; i++) {"
+  "    var e = f[s[i][0]];"
+  "    if (!e) continue;"
+  "    if (e.type == 'checkbox' || e.type == 'radio') e.checked = s[i][1] == '1';"
+  "    else e.value = s[i][1];"
+  "  }"
+  "})(%1)";
+
+PageState::PageState(QWebPage *page, const QUrl &url, const QPoint &scroll, const QVariantList &form) :
+  QObject(page)
+  ,m_page(page)
+  ,m_url(url)
+  ,m_scroll(scroll)
+  ,m_form(form)
+{
+  connect(page, SIGNAL(loadFinished(bool)), this, SLOT(onLoadFinished(bool)));
+}
+
+QByteArray PageState::save(QWebPage *page) {
+  QWebFrame *frame = page->mainFrame();
+  QByteArray state;
+  QDataStream stream(&state, QIODevice::WriteOnly);
+
+  stream.setVersion(QDataStream::Qt_5_0);
+  stream << (quint32)PAGE_STATE_MAGIC << (quint32)PAGE_STATE_VERSION;
+  stream << frame->url() << frame->zoomFactor() << frame->scrollPosition();
+  stream << frame->evaluateJavaScript(save_form_js).toList();
+  stream << (qint32)page->history()->currentItemIndex() << (qint32)page->history()->count();
+  // last, since reading it back starts the navigation
+  stream << *page->history();
+
+  return state;
+}
+
+bool PageState::restore(QWebPage *page, const QByteArray &state) {
+  QDataStream stream(state);
+  quint32 magic = 0;
+  quint32 version = 0;
+  QUrl url;
+  qreal zoom = 1.0;
+  QPoint scroll;
+  QVariantList form;
+  qint32 index = -1;
+  qint32 count = -1;
+
+  stream.setVersion(QDataStream::Qt_5_0);
+  stream >> magic >> version;
+
+  // version 1 lacks the history position and always navigates
+  if(magic != PAGE_STATE_MAGIC || version < 1 || version > PAGE_STATE_VERSION)
+    return false;
+
+  stream >> url >> zoom >> scroll >> form;
+
+  if(version >= 2)
+    stream >> index >> count;
+
+  if(stream.status() != QDataStream::Ok)
+    return false;
+
+  page->mainFrame()->setZoomFactor(zoom);
+
+  // already there, as when a state is loaded right after being saved
+  if(url == page->mainFrame()->url() && index == page->history()->currentItemIndex()
+      && count == page->history()->count()) {
+    apply(page->mainFrame(), scroll, form);
+    return true;
+  }
+
+  // applied once the restored page has loaded, then it deletes itself
+  new PageState(page, url, scroll, form);
+
+  stream >> *page->history();
+
+  if(stream.status() != QDataStream::Ok || page->history()->count() == 0) {
+    page->mainFrame()->load(url);
+    return stream.status() == QDataStream::Ok;
+  }
+
+  return true;
+}
+
+void PageState::apply(QWebFrame *frame, const QPoint &scroll, const QVariantList &form) {
+  if(!form.isEmpty())
+    frame->evaluateJavaScript(QString(restore_form_js).arg(QString::fromUtf8(QJsonDocument::fromVariant(form).toJson(QJsonDocument::Compact))));
+
+  frame->setScrollPosition(scroll);
+}
+
+/* The load that was interrupted by the restore also reports in here, as a
+ * failure, so only a successful load ends the wait. */
+void PageState::onLoadFinished(bool ok) {
+  QWebFrame *frame = m_page->mainFrame();
+
+  if(!ok)
+    return;
+
+  if(frame->url() == m_url)
+    apply(frame, m_scroll, m_form);
+
+  disconnect(m_page, 0, this, 0);
+  deleteLater();
+}
@@ -0,0 +1,37 @@
+#ifndef PAGESTATE_H
+#define PAGESTATE_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QPoint>
+#include <QUrl>
+#include <QVariantList>
+
+class QWebPage;
+class QWebFrame;
+
+/* Serializes what is needed to bring a page back as the user left it: URL,
+ * back/forward history, zoom, scroll position and edited form fields. */
+class PageState : public QObject
+{
+  Q_OBJECT
+
+public:
+  static QByteArray save(QWebPage *page);
+  static bool restore(QWebPage *page, const QByteArray &state);
+
+private slots:
+  void onLoadFinished(bool ok);
+
+private:
+  PageState(QWebPage *page, const QUrl &url, const QPoint &scroll, const QVariantList &form);
+
+  static void apply(QWebFrame *frame, const QPoint &scroll, const QVariantList &form);
+
+  QWebPage *m_page;
+  QUrl m_url;
+  QPoint m_scroll;
+  QVariantList m_form;
+};
+
+#endif // PAGESTATE_H
@@ -0,0 +1,72 @@
+#include "replayclock.h"
+#include <QWebPage>
+#include <QWebFrame>
+
+static const char shim[] =
+  "(function(seed, clock) {"
+  "  var state = seed >>> 0 || 1;"
+  "  var RealDate = Date;"
+  "  Math.random = function() {"
+  "    state ^= state << 13; state >>>= 0;"
+  "    state ^= state >>> 17;"
+  "    state ^= state << 5; state >>>= 0;"
+  "    return state / 4294967296;"
+  "  };"
+  "  function ReplayDate(y, m, d, h, min, s, ms) {"
+  "    if(!(this instanceof ReplayDate))"
+  "      return new RealDate(clock.now).toString();"
+  "    switch(arguments.length) {"
+  "      case 0: return new RealDate(clock.now);"
+  "      case 1: return new RealDate(y);"
+  "      default: return new RealDate(y, m, d === undefined ? 1 : d, h || 0, min || 0, s || 0, ms || 0);"
+  "    }"
+  "  }"
+  "  ReplayDate.prototype = RealDate.prototype;"
+  "  ReplayDate.now = function() { return clock.now; };"
+  "  ReplayDate.parse = RealDate.parse;"
+  "  ReplayDate.UTC = RealDate.UTC;"
+  "  window.Date = ReplayDate;"
+  "  if(window.performance)"
+  "    window.performance.now = function() { return clock.elapsed; };"
+  "})(%1, window.__minibrowserClock);";
+
+ReplayClock::ReplayClock(quint32 seed, qint64 epoch, QObject *parent) :
+  QObject(parent)
+  ,m_seed(seed)
+  ,m_epoch(epoch)
+  ,m_time(0)
+{
+}
+
+/* Frames that already have a document only pick the shim up on their next
+ * navigation, so attach before loading what is to be replayed. */
+void ReplayClock::attach(QWebPage *page) {
+  connect(page, SIGNAL(frameCreated(QWebFrame*)), this, SLOT(onFrameCreated(QWebFrame*)));
+  onFrameCreated(page->mainFrame());
+}
+
+void ReplayClock::setTime(qint64 msec) {
+  m_time = msec;
+}
+
+double ReplayClock::now() const {
+  return (double)(m_epoch + m_time);
+}
+
+double ReplayClock::elapsed() const {
+  return (double)m_time;
+}
+
+void ReplayClock::onFrameCreated(QWebFrame *frame) {
+  connect(frame, SIGNAL(javaScriptWindowObjectCleared()), this, SLOT(onWindowCleared()), Qt::UniqueConnection);
+}
+
+void ReplayClock::onWindowCleared() {
+  QWebFrame *frame = qobject_cast<QWebFrame*>(sender());
+
+  if(!frame)
+    return;
+
+  frame->addToJavaScriptWindowObject("__minibrowserClock", this);
+  frame->evaluateJavaScript(QString(shim).arg(m_seed));
+}
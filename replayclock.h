@@ -0,0 +1,39 @@
+#ifndef REPLAYCLOCK_H
+#define REPLAYCLOCK_H
+
+#include <QObject>
+
+class QWebPage;
+class QWebFrame;
+
+/* Makes a page's scripts see a clock and random numbers the host controls.
+ * Every frame's Date, performance.now() and Math.random() are replaced as
+ * soon as its window object exists: the clock only moves when setTime() is
+ * called, and Math.random() is a xorshift generator seeded the same way in
+ * every frame. */
+class ReplayClock : public QObject
+{
+  Q_OBJECT
+  Q_PROPERTY(double now READ now)
+  Q_PROPERTY(double elapsed READ elapsed)
+
+public:
+  ReplayClock(quint32 seed, qint64 epoch, QObject *parent = 0);
+
+  void attach(QWebPage *page);
+  void setTime(qint64 msec);
+
+  double now() const;
+  double elapsed() const;
+
+private slots:
+  void onFrameCreated(QWebFrame *frame);
+  void onWindowCleared();
+
+private:
+  quint32 m_seed;
+  qint64 m_epoch;
+  qint64 m_time;
+};
+
+#endif // REPLAYCLOCK_H
@@ -0,0 +1,78 @@
+#include "scalegovernor.h"
+
+#define GOVERNOR_STEP 10
+
+/* Weight of the newest render time in the running average. */
+#define GOVERNOR_SMOOTHING 0.1
+
+/* Frames the average must stay over budget before stepping down, and with
+ * headroom before stepping up. Going down is urgent, going up is not. */
+#define GOVERNOR_OVER_FRAMES 10
+#define GOVERNOR_UNDER_FRAMES 120
+
+/* Share of the budget the next step up may be predicted to use. */
+#define GOVERNOR_HEADROOM_PERCENT 85
+
+ScaleGovernor::ScaleGovernor() :
+  m_min(100)
+  ,m_max(100)
+  ,m_scale(100)
+  ,m_average(0.0)
+  ,m_over(0)
+  ,m_under(0)
+{
+}
+
+/* A range of one value fixes the scale. */
+void ScaleGovernor::setRange(int minPercent, int maxPercent) {
+  m_min = qBound(1, minPercent, 100);
+  m_max = qBound(m_min, maxPercent, 100);
+  m_scale = qBound(m_min, m_scale, m_max);
+
+  if(m_min == m_max)
+    m_scale = m_max;
+
+  m_over = 0;
+  m_under = 0;
+}
+
+int ScaleGovernor::scale() const {
+  return m_scale;
+}
+
+/* Feeds in one frame's render time. Returns true when the scale changed. */
+bool ScaleGovernor::sample(qint64 renderUsec, qint64 budgetUsec) {
+  double next;
+
+  if(m_average <= 0.0)
+    m_average = renderUsec;
+  else
+    m_average += (renderUsec - m_average) * GOVERNOR_SMOOTHING;
+
+  if(m_min == m_max || budgetUsec <= 0)
+    return false;
+
+  m_over = m_average > budgetUsec ? m_over + 1 : 0;
+
+  // render time follows the number of pixels, so the square of the scale
+  next = qMin(m_scale + GOVERNOR_STEP, m_max);
+  next = m_average * (next * next) / ((double)m_scale * m_scale);
+  m_under = m_scale < m_max && next < budgetUsec * GOVERNOR_HEADROOM_PERCENT / 100.0 ? m_under + 1 : 0;
+
+  if(m_over >= GOVERNOR_OVER_FRAMES && m_scale > m_min) {
+    m_scale = qMax(m_scale - GOVERNOR_STEP, m_min);
+    // the old average says nothing about the new scale
+    m_average = 0.0;
+    m_over = 0;
+    return true;
+  }
+
+  if(m_under >= GOVERNOR_UNDER_FRAMES) {
+    m_scale = qMin(m_scale + GOVERNOR_STEP, m_max);
+    m_average = 0.0;
+    m_under = 0;
+    return true;
+  }
+
+  return false;
+}
@@ -0,0 +1,28 @@
+#ifndef SCALEGOVERNOR_H
+#define SCALEGOVERNOR_H
+
+#include <QtGlobal>
+
+/* Picks the internal render scale from how long rendering takes. The scale
+ * drops a step as soon as the average render time runs over the budget,
+ * and only rises again once the next step up is predicted to fit with
+ * room to spare, so it doesn't bounce between two steps. */
+class ScaleGovernor
+{
+public:
+  ScaleGovernor();
+
+  void setRange(int minPercent, int maxPercent);
+  bool sample(qint64 renderUsec, qint64 budgetUsec);
+  int scale() const;
+
+private:
+  int m_min;
+  int m_max;
+  int m_scale;
+  double m_average;
+  int m_over;
+  int m_under;
+};
+
+#endif // SCALEGOVERNOR_H
@@ -0,0 +1,54 @@
+#include "scriptwatchdog.h"
+
+ScriptWatchdog::ScriptWatchdog() :
+  m_enabled(false)
+  ,m_blockOrigins(false)
+  ,m_frame()
+  ,m_blocked()
+  ,m_interruptions(0)
+{
+}
+
+/* Turned off, scripts run for as long as they like. */
+void ScriptWatchdog::setEnabled(bool on) {
+  m_enabled = on;
+}
+
+bool ScriptWatchdog::enabled() const {
+  return m_enabled;
+}
+
+/* Turning this off forgets the sites blocked so far. */
+void ScriptWatchdog::setBlockOrigins(bool on) {
+  m_blockOrigins = on;
+
+  if(!on)
+    m_blocked.clear();
+}
+
+void ScriptWatchdog::frameStarted() {
+  m_frame.start();
+}
+
+qint64 ScriptWatchdog::elapsed() const {
+  return m_frame.isValid() ? m_frame.elapsed() : 0;
+}
+
+void ScriptWatchdog::interrupted(const QUrl &url) {
+  m_interruptions++;
+
+  if(m_blockOrigins && url.isValid())
+    m_blocked.insert(origin(url));
+}
+
+bool ScriptWatchdog::blocked(const QUrl &url) const {
+  return !m_blocked.isEmpty() && m_blocked.contains(origin(url));
+}
+
+int ScriptWatchdog::interruptions() const {
+  return m_interruptions;
+}
+
+QString ScriptWatchdog::origin(const QUrl &url) {
+  return url.scheme() + "://" + url.authority();
+}
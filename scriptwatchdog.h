@@ -0,0 +1,40 @@
+#ifndef SCRIPTWATCHDOG_H
+#define SCRIPTWATCHDOG_H
+
+#include <QElapsedTimer>
+#include <QSet>
+#include <QString>
+#include <QUrl>
+
+/* Decides whether a long-running page script is stopped. WebKit asks once
+ * a script has run for about ten seconds without yielding, and every ten
+ * seconds after that; the interval is fixed inside WebKit, so all that is
+ * left to choose is whether to say yes. The host restarts the clock each
+ * time it enters the core, which says how long the script has held things
+ * up. Sites whose scripts had to be stopped can be remembered so their
+ * scripts are not run again this session. */
+class ScriptWatchdog
+{
+public:
+  ScriptWatchdog();
+
+  void setEnabled(bool on);
+  bool enabled() const;
+  void setBlockOrigins(bool on);
+  void frameStarted();
+  qint64 elapsed() const;
+  void interrupted(const QUrl &url);
+  bool blocked(const QUrl &url) const;
+  int interruptions() const;
+
+private:
+  static QString origin(const QUrl &url);
+
+  bool m_enabled;
+  bool m_blockOrigins;
+  QElapsedTimer m_frame;
+  QSet<QString> m_blocked;
+  int m_interruptions;
+};
+
+#endif // SCRIPTWATCHDOG_H
@@ -0,0 +1,44 @@
+#include "webpage.h"
+#include "scriptwatchdog.h"
+#include "corelog.h"
+#include <QWebFrame>
+#include <QWebSettings>
+#include <QNetworkRequest>
+
+WebPage::WebPage(ScriptWatchdog *watchdog, QObject *parent) :
+  QWebPage(parent)
+  ,m_watchdog(watchdog)
+{
+}
+
+/* Not virtual: WebKit looks the slot up by name, so this one is found
+ * before QWebPage's. */
+bool WebPage::shouldInterruptJavaScript() {
+  QUrl url = mainFrame()->url();
+
+  if(!m_watchdog->enabled())
+    return false;
+
+  m_watchdog->interrupted(url);
+
+  CORE_LOG(RETRO_LOG_WARN, "Interrupted a script on %s after %lld ms%s.\n",
+      url.toString().toUtf8().constData(), (long long)m_watchdog->elapsed(),
+      m_watchdog->blocked(url) ? ", JavaScript is now off for the site" : "");
+
+  // whatever else the page has queued would only stall the next frame
+  if(m_watchdog->blocked(url))
+    settings()->setAttribute(QWebSettings::JavascriptEnabled, false);
+
+  return true;
+}
+
+bool WebPage::acceptNavigationRequest(QWebFrame *frame, const QNetworkRequest &request, NavigationType type) {
+  if(frame == mainFrame()) {
+    if(m_watchdog->blocked(request.url()))
+      settings()->setAttribute(QWebSettings::JavascriptEnabled, false);
+    else
+      settings()->resetAttribute(QWebSettings::JavascriptEnabled);
+  }
+
+  return QWebPage::acceptNavigationRequest(frame, request, type);
+}
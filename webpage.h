@@ -0,0 +1,29 @@
+#ifndef WEBPAGE_H
+#define WEBPAGE_H
+
+#include <QWebPage>
+
+class ScriptWatchdog;
+
+/* The page every tab uses. WebKit asks it whether to stop a script that
+ * has been running for a while; a plain QWebPage would put up a modal
+ * dialog nobody can answer, here the watchdog decides. Main frame loads of
+ * a site the watchdog blocked run without JavaScript. */
+class WebPage : public QWebPage
+{
+  Q_OBJECT
+
+public:
+  WebPage(ScriptWatchdog *watchdog, QObject *parent = 0);
+
+public slots:
+  bool shouldInterruptJavaScript();
+
+protected:
+  bool acceptNavigationRequest(QWebFrame *frame, const QNetworkRequest &request, NavigationType type);
+
+private:
+  ScriptWatchdog *m_watchdog;
+};
+
+#endif // WEBPAGE_H